@@ -0,0 +1,85 @@
+#pragma once
+
+#include <algorithm>    // std::max
+#include <cstddef>      // std::byte, std::size_t
+#include <cstdint>      // std::uintptr_t
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>      // std::forward
+#include <vector>
+
+// An Arena owns the AST of one compilation unit. Nodes are bump
+// allocated out of large blocks, so creating one costs little more
+// than a pointer increment, and they are all freed together when the
+// arena is destroyed. Since no node can outlive the tree it belongs
+// to, nodes refer to each other with plain pointers and nothing is
+// reference counted.
+class Arena {
+  static constexpr std::size_t blockSize = 64 * 1024;
+
+  // Nodes still own a little memory of their own, like their vectors
+  // of children. The destructors of such objects are chained together
+  // so they can run before the blocks are released.
+  struct Finalizer {
+    void (*destroy)(void* object);
+    void* object;
+    Finalizer* next;
+  };
+
+  std::vector<std::unique_ptr<std::byte[]>> blocks;
+  std::byte* next = nullptr;
+  std::size_t remaining = 0;
+  Finalizer* finalizers = nullptr;
+
+public:
+  Arena() = default;
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+  ~Arena() {
+    // The most recently created objects are destroyed first.
+    for (Finalizer* finalizer = finalizers; finalizer != nullptr;
+         finalizer = finalizer->next) {
+      finalizer->destroy(finalizer->object);
+    }
+  }
+
+  template <class T, class... Args>
+  T* make(Args&&... args) {
+    void* memory = allocate(sizeof(T), alignof(T));
+    T* object = new (memory) T(std::forward<Args>(args)...);
+
+    if constexpr (!std::is_trivially_destructible_v<T>) {
+      void* record = allocate(sizeof(Finalizer), alignof(Finalizer));
+      finalizers = new (record) Finalizer{
+          [] (void* object) { static_cast<T*>(object)->~T(); },
+          object, finalizers};
+    }
+
+    return object;
+  }
+
+private:
+  void* allocate(std::size_t size, std::size_t alignment) {
+    std::size_t padding = paddingFor(alignment);
+
+    if (padding + size > remaining) {
+      std::size_t capacity = std::max(blockSize, size + alignment);
+      blocks.emplace_back(new std::byte[capacity]);
+      next = blocks.back().get();
+      remaining = capacity;
+      padding = paddingFor(alignment);
+    }
+
+    void* memory = next + padding;
+    next += padding + size;
+    remaining -= padding + size;
+    return memory;
+  }
+
+  std::size_t paddingFor(std::size_t alignment) {
+    auto address = reinterpret_cast<std::uintptr_t>(next);
+    return (alignment - address % alignment) % alignment;
+  }
+};
@@ -1,6 +1,5 @@
 #pragma once
 
-#include <any>
 #include <cassert>
 #include <memory>
 #include <iostream>
@@ -8,40 +7,41 @@
 #include <string>
 #include <type_traits>
 #include "Expr.h"
+#include "Number.h"
+#include "Value.h"
 
-class AstPrinter: public ExprVisitor {
+class AstPrinter: public ExprVisitor<std::string> {
 public:
-  std::string print(std::shared_ptr<Expr> expr) {
-    return std::any_cast<std::string>(expr->accept(*this));
+  std::string print(Expr* expr) {
+    return expr->accept(*this);
   }
 
-  std::any visitBinaryExpr(std::shared_ptr<Binary> expr) override {
+  std::string visitBinaryExpr(Binary* expr) override {
     return parenthesize(expr->op.lexeme,
                         expr->left, expr->right);
   }
 
-  std::any visitGroupingExpr(
-      std::shared_ptr<Grouping> expr) override {
+  std::string visitGroupingExpr(Grouping* expr) override {
     return parenthesize("group", expr->expression);
   }
 
-  std::any visitLiteralExpr(std::shared_ptr<Literal> expr) override {
-    auto& value_type = expr->value.type();
-
-    if (value_type == typeid(nullptr)) {
-      return "nil";
-    } else if (value_type == typeid(std::string)) {
-      return std::any_cast<std::string>(expr->value);
-    } else if (value_type == typeid(double)) {
-      return std::to_string(std::any_cast<double>(expr->value));
-    } else if (value_type == typeid(bool)) {
-      return std::any_cast<bool>(expr->value) ? "true" : "false";
+  std::string visitLiteralExpr(Literal* expr) override {
+    switch (expr->value.type()) {
+      case ValueType::NIL: return "nil";
+      case ValueType::STRING: return expr->value.asString();
+      case ValueType::NUMBER: {
+        char buffer[NUMBER_LENGTH];
+        double number = expr->value.asNumber();
+        return std::string{formatNumber(number, buffer)};
+      }
+      case ValueType::BOOL:
+        return expr->value.asBool() ? "true" : "false";
     }
 
     return "Error in visitLiteralExpr: literal type not recognized.";
   }
 
-  std::any visitUnaryExpr(std::shared_ptr<Unary> expr) override {
+  std::string visitUnaryExpr(Unary* expr) override {
     return parenthesize(expr->op.lexeme, expr->right);
   }
 
@@ -49,7 +49,7 @@ private:
   template <class... E>
   std::string parenthesize(std::string_view name, E... expr)
   {
-    assert((... && std::is_same_v<E, std::shared_ptr<Expr>>));
+    assert((... && std::is_same_v<E, Expr*>));
 
     std::ostringstream builder;
 
@@ -1,14 +1,16 @@
+#include "Arena.h"
 #include "AstPrinter.h"
 
 int main(int argc, char* argv[]) {
-  std::shared_ptr<Expr> expression = std::make_shared<Binary>(
-      std::make_shared<Unary>(
+  Arena arena;
+  Expr* expression = arena.make<Binary>(
+      arena.make<Unary>(
           Token{MINUS, "-", nullptr, 1},
-          std::make_shared<Literal>(123.)
+          arena.make<Literal>(123.)
       ),
       Token{STAR, "*", nullptr, 1},
-      std::make_shared<Grouping>(
-          std::make_shared<Literal>(45.67)));
+      arena.make<Grouping>(
+          arena.make<Literal>(45.67)));
 
   std::cout << AstPrinter{}.print(expression) << "\n";
 }
\ No newline at end of file
@@ -0,0 +1,448 @@
+#pragma once
+
+#include <cstdint>      // std::uint8_t, std::uint16_t
+#include <memory>
+#include <string_view>
+#include <utility>      // std::move
+#include <vector>
+#include "Chunk.h"
+#include "Error.h"
+#include "Expr.h"
+#include "Globals.h"
+#include "Stmt.h"
+#include "Token.h"
+#include "Value.h"
+
+// Compiles a resolved AST into bytecode for the VM. Variables keep the
+// places the Resolver gave them: locals are addressed by the depth and
+// slot of their environment, and globals by their slot in the globals
+// table, which the compiler interns up front. Expressions leave their
+// value on top of the VM's stack and statements leave the stack as
+// they found it.
+class BytecodeCompiler: public ExprVisitor<void>,
+                        public StmtVisitor<void> {
+  Globals& globals;
+  Chunk* chunk = nullptr;
+
+  // Only declarations made outside of any block or function are
+  // global.
+  int scopeDepth = 0;
+
+  // One entry for each scope the Resolver counted in a depth,
+  // innermost last, recording whether the scope was left out. A block
+  // that declares nothing doesn't need an environment, so it gets
+  // none, and accesses from inside it skip over it.
+  std::vector<bool> elided;
+
+public:
+  BytecodeCompiler(Globals& globals)
+    : globals{globals}
+  {}
+
+  std::shared_ptr<const Chunk> compile(
+      const std::vector<Stmt*>& statements) {
+    auto script = std::make_shared<Chunk>();
+    chunk = script.get();
+
+    for (Stmt* statement : statements) {
+      compile(statement);
+    }
+
+    emit(OpCode::NIL, nullptr);
+    emit(OpCode::RETURN, nullptr);
+
+    return script;
+  }
+
+private:
+  void compile(Expr* expr) {
+    expr->accept(*this);
+  }
+
+  void compile(Stmt* stmt) {
+    stmt->accept(*this);
+  }
+
+  FunctionPrototype compileFunction(Function* function) {
+    auto body = std::make_shared<Chunk>();
+    Chunk* enclosingChunk = chunk;
+    int enclosingDepth = scopeDepth;
+    chunk = body.get();
+    scopeDepth = 1;
+    elided.push_back(false);
+
+    for (Stmt* statement : function->body) {
+      compile(statement);
+    }
+
+    // Falling off the end of a function returns nil.
+    emit(OpCode::NIL, nullptr);
+    emit(OpCode::RETURN, nullptr);
+
+    elided.pop_back();
+    chunk = enclosingChunk;
+    scopeDepth = enclosingDepth;
+    return FunctionPrototype{function, std::move(body)};
+  }
+
+  void define(const Token& name) {
+    if (scopeDepth == 0) {
+      emit(OpCode::DEFINE_GLOBAL, &name);
+      emitShort(globals.intern(name.lexeme), name);
+    } else {
+      emit(OpCode::DEFINE_LOCAL, &name);
+    }
+  }
+
+  void variable(OpCode local, OpCode global, const Token& name,
+                int depth, int& slot) {
+    if (depth >= 0) {
+      emit(local, &name);
+      emitShort(runtimeDepth(depth), name);
+      emitShort(slot, name);
+    } else {
+      if (slot < 0) slot = globals.intern(name.lexeme);
+      emit(global, &name);
+      emitShort(slot, name);
+    }
+  }
+
+  // Compiles the depth the Resolver found for a variable into the
+  // number of environments the VM actually has to walk through.
+  int runtimeDepth(int depth) {
+    int skipped = 0;
+    for (int i = 1; i <= depth; ++i) {
+      if (elided[elided.size() - i]) ++skipped;
+    }
+
+    return depth - skipped;
+  }
+
+  static bool declaresVariables(const std::vector<Stmt*>& statements) {
+    for (Stmt* statement : statements) {
+      switch (statement->type) {
+        case StmtType::CLASS:
+        case StmtType::FUNCTION:
+        case StmtType::VAR:
+          return true;
+        default:
+          break;
+      }
+    }
+
+    return false;
+  }
+
+public:
+  void visitBlockStmt(Block* stmt) override {
+    bool scoped = declaresVariables(stmt->statements);
+
+    if (scoped) emit(OpCode::BEGIN_SCOPE, nullptr);
+    ++scopeDepth;
+    elided.push_back(!scoped);
+
+    for (Stmt* statement : stmt->statements) {
+      compile(statement);
+    }
+
+    elided.pop_back();
+    --scopeDepth;
+    if (scoped) emit(OpCode::END_SCOPE, nullptr);
+  }
+
+  void visitClassStmt(Class* stmt) override {
+    if (stmt->superclass != nullptr) {
+      compile(stmt->superclass);
+      emit(OpCode::INHERIT, &stmt->superclass->name);
+      ++scopeDepth;
+      elided.push_back(false);
+    }
+
+    // A method finds "this" in the first slot of its own scope.
+    ClassPrototype klass{stmt, {}};
+    for (Function* method : stmt->methods) {
+      klass.methods.push_back(compileFunction(method));
+    }
+
+    chunk->classes.push_back(std::move(klass));
+    emit(OpCode::CLASS, &stmt->name);
+    emitShort(chunk->classes.size() - 1, stmt->name);
+
+    if (stmt->superclass != nullptr) {
+      elided.pop_back();
+      --scopeDepth;
+      emit(OpCode::END_SCOPE, nullptr);
+    }
+
+    define(stmt->name);
+  }
+
+  void visitExpressionStmt(Expression* stmt) override {
+    compile(stmt->expression);
+    emit(OpCode::POP, nullptr);
+  }
+
+  void visitFunctionStmt(Function* stmt) override {
+    chunk->functions.push_back(compileFunction(stmt));
+    emit(OpCode::FUNCTION, &stmt->name);
+    emitShort(chunk->functions.size() - 1, stmt->name);
+    define(stmt->name);
+  }
+
+  void visitIfStmt(If* stmt) override {
+    compile(stmt->condition);
+
+    int thenJump = emitJump(OpCode::JUMP_IF_FALSE);
+    emit(OpCode::POP, nullptr);
+    compile(stmt->thenBranch);
+
+    int elseJump = emitJump(OpCode::JUMP);
+    patchJump(thenJump);
+    emit(OpCode::POP, nullptr);
+
+    if (stmt->elseBranch != nullptr) compile(stmt->elseBranch);
+    patchJump(elseJump);
+  }
+
+  void visitPrintStmt(Print* stmt) override {
+    compile(stmt->expression);
+    emit(OpCode::PRINT, nullptr);
+  }
+
+  void visitReturnStmt(Return* stmt) override {
+    if (stmt->value != nullptr) {
+      compile(stmt->value);
+    } else {
+      emit(OpCode::NIL, &stmt->keyword);
+    }
+
+    emit(OpCode::RETURN, &stmt->keyword);
+  }
+
+  void visitVarStmt(Var* stmt) override {
+    if (stmt->initializer != nullptr) {
+      compile(stmt->initializer);
+    } else {
+      emit(OpCode::NIL, &stmt->name);
+    }
+
+    define(stmt->name);
+  }
+
+  void visitWhileStmt(While* stmt) override {
+    int loopStart = chunk->code.size();
+    compile(stmt->condition);
+
+    int exitJump = emitJump(OpCode::JUMP_IF_FALSE);
+    emit(OpCode::POP, nullptr);
+    compile(stmt->body);
+    emitLoop(loopStart);
+
+    patchJump(exitJump);
+    emit(OpCode::POP, nullptr);
+  }
+
+  void visitAssignExpr(Assign* expr) override {
+    compile(expr->value);
+    variable(OpCode::SET_LOCAL, OpCode::SET_GLOBAL, expr->name,
+             expr->depth, expr->slot);
+  }
+
+  void visitBinaryExpr(Binary* expr) override {
+    compile(expr->left);
+    compile(expr->right);
+
+    switch (expr->op.type) {
+      case BANG_EQUAL: emit(OpCode::NOT_EQUAL, &expr->op); break;
+      case EQUAL_EQUAL: emit(OpCode::EQUAL, &expr->op); break;
+      case GREATER: emit(OpCode::GREATER, &expr->op); break;
+      case GREATER_EQUAL: emit(OpCode::GREATER_EQUAL, &expr->op); break;
+      case LESS: emit(OpCode::LESS, &expr->op); break;
+      case LESS_EQUAL: emit(OpCode::LESS_EQUAL, &expr->op); break;
+      case MINUS: emit(OpCode::SUBTRACT, &expr->op); break;
+      case PLUS: emit(OpCode::ADD, &expr->op); break;
+      case SLASH: emit(OpCode::DIVIDE, &expr->op); break;
+      case STAR: emit(OpCode::MULTIPLY, &expr->op); break;
+    }
+  }
+
+  void visitCallExpr(Call* expr) override {
+    // A method called right away is invoked on its instance without
+    // being bound to it.
+    OpCode call = OpCode::INVOKE;
+    switch (expr->callee->type) {
+      case ExprType::GET: {
+        auto get = static_cast<Get*>(expr->callee);
+        compile(get->object);
+        emit(OpCode::GET_METHOD, &get->name);
+        emitShort(chunk->caches.size(), get->name);
+        chunk->caches.push_back(&get->cache);
+        break;
+      }
+      case ExprType::SUPER: {
+        auto super = static_cast<Super*>(expr->callee);
+        emit(OpCode::GET_SUPER_METHOD, &super->method);
+        emitShort(runtimeDepth(super->depth), super->method);
+        break;
+      }
+      default:
+        compile(expr->callee);
+        call = OpCode::CALL;
+        break;
+    }
+
+    for (Expr* argument : expr->arguments) {
+      compile(argument);
+    }
+
+    if (expr->tail) {
+      call = call == OpCode::CALL ? OpCode::TAIL_CALL
+                                  : OpCode::TAIL_INVOKE;
+    }
+
+    // The Parser allows at most 255 arguments.
+    emit(call, &expr->paren);
+    chunk->write(expr->arguments.size(), &expr->paren);
+  }
+
+  void visitGetExpr(Get* expr) override {
+    compile(expr->object);
+    emit(OpCode::GET_PROPERTY, &expr->name);
+    emitShort(chunk->caches.size(), expr->name);
+    chunk->caches.push_back(&expr->cache);
+  }
+
+  void visitGroupingExpr(Grouping* expr) override {
+    compile(expr->expression);
+  }
+
+  void visitLiteralExpr(Literal* expr) override {
+    switch (expr->value.type()) {
+      case ValueType::NIL: emit(OpCode::NIL, nullptr); return;
+      case ValueType::BOOL:
+        emit(expr->value.asBool() ? OpCode::TRUE : OpCode::FALSE,
+             nullptr);
+        return;
+      default:
+        break;
+    }
+
+    chunk->constants.push_back(expr->value);
+    emit(OpCode::CONSTANT, nullptr);
+    emitShort(chunk->constants.size() - 1, nullptr);
+  }
+
+  void visitLogicalExpr(Logical* expr) override {
+    compile(expr->left);
+
+    if (expr->op.type == OR) {
+      int elseJump = emitJump(OpCode::JUMP_IF_FALSE);
+      int endJump = emitJump(OpCode::JUMP);
+
+      patchJump(elseJump);
+      emit(OpCode::POP, nullptr);
+      compile(expr->right);
+      patchJump(endJump);
+    } else {
+      int endJump = emitJump(OpCode::JUMP_IF_FALSE);
+
+      emit(OpCode::POP, nullptr);
+      compile(expr->right);
+      patchJump(endJump);
+    }
+  }
+
+  void visitSetExpr(Set* expr) override {
+    // The object is checked before the value is evaluated, as in the
+    // Interpreter.
+    compile(expr->object);
+    emit(OpCode::CHECK_INSTANCE, &expr->name);
+    compile(expr->value);
+    emit(OpCode::SET_PROPERTY, &expr->name);
+    emitShort(chunk->caches.size(), expr->name);
+    chunk->caches.push_back(&expr->cache);
+  }
+
+  void visitSuperExpr(Super* expr) override {
+    // The instance is in the scope just inside the superclass's, and
+    // neither is ever left out.
+    emit(OpCode::GET_SUPER, &expr->method);
+    emitShort(runtimeDepth(expr->depth), expr->method);
+  }
+
+  void visitThisExpr(This* expr) override {
+    variable(OpCode::GET_LOCAL, OpCode::GET_GLOBAL, expr->keyword,
+             expr->depth, expr->slot);
+  }
+
+  void visitUnaryExpr(Unary* expr) override {
+    compile(expr->right);
+
+    switch (expr->op.type) {
+      case BANG: emit(OpCode::NOT, &expr->op); break;
+      case MINUS: emit(OpCode::NEGATE, &expr->op); break;
+    }
+  }
+
+  void visitVariableExpr(Variable* expr) override {
+    variable(OpCode::GET_LOCAL, OpCode::GET_GLOBAL, expr->name,
+             expr->depth, expr->slot);
+  }
+
+private:
+  void emit(OpCode op, const Token* token) {
+    chunk->write(static_cast<std::uint8_t>(op), token);
+  }
+
+  void emitShort(int operand, const Token& token) {
+    emitShort(operand, &token);
+  }
+
+  void emitShort(int operand, const Token* token) {
+    if (operand > UINT16_MAX) {
+      compileError(token, "Too many operands in one chunk.");
+    }
+
+    chunk->write(operand & 0xff, token);
+    chunk->write((operand >> 8) & 0xff, token);
+  }
+
+  // Returns the offset of the jump's operand so it can be patched once
+  // the target is known.
+  int emitJump(OpCode op) {
+    emit(op, nullptr);
+    emitShort(0, nullptr);
+    return chunk->code.size() - 2;
+  }
+
+  void patchJump(int offset) {
+    // -2 to adjust for the jump offset itself.
+    int jump = chunk->code.size() - offset - 2;
+
+    if (jump > UINT16_MAX) {
+      compileError(nullptr, "Too much code to jump over.");
+    }
+
+    chunk->code[offset] = jump & 0xff;
+    chunk->code[offset + 1] = (jump >> 8) & 0xff;
+  }
+
+  void emitLoop(int loopStart) {
+    emit(OpCode::LOOP, nullptr);
+
+    int offset = chunk->code.size() - loopStart + 2;
+    if (offset > UINT16_MAX) {
+      compileError(nullptr, "Loop body too large.");
+    }
+
+    emitShort(offset, nullptr);
+  }
+
+  void compileError(const Token* token, std::string_view message) {
+    if (token != nullptr) {
+      error(*token, message);
+    } else {
+      error(0, message);
+    }
+  }
+};
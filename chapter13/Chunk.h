@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>      // std::uint8_t, std::uint16_t
+#include <memory>
+#include <vector>
+#include "Shape.h"
+#include "Stmt.h"
+#include "Token.h"
+#include "Value.h"
+
+// The instructions of the bytecode VM. Operands follow the opcode in
+// the instruction stream and are all 16 bits wide, except for the
+// argument counts of the calls, which are a single byte.
+enum class OpCode: std::uint8_t {
+  CONSTANT,         // constant       -- push constants[constant]
+  NIL,
+  TRUE,
+  FALSE,
+  POP,
+  GET_LOCAL,        // depth, slot
+  SET_LOCAL,        // depth, slot    -- leaves the value on the stack
+  DEFINE_LOCAL,     //                -- into the next slot
+  GET_GLOBAL,       // slot
+  SET_GLOBAL,       // slot           -- leaves the value on the stack
+  DEFINE_GLOBAL,    // slot
+  GET_PROPERTY,     // cache
+  CHECK_INSTANCE,   //                -- the target of a SET_PROPERTY
+  SET_PROPERTY,     // cache
+  GET_SUPER,        // depth
+  GET_METHOD,       // cache          -- push the callee and receiver
+  GET_SUPER_METHOD, // depth          -- push the method and receiver
+  EQUAL,
+  NOT_EQUAL,
+  GREATER,
+  GREATER_EQUAL,
+  LESS,
+  LESS_EQUAL,
+  ADD,
+  SUBTRACT,
+  MULTIPLY,
+  DIVIDE,
+  NOT,
+  NEGATE,
+  PRINT,
+  JUMP,             // offset
+  JUMP_IF_FALSE,    // offset         -- leaves the condition
+  LOOP,             // offset
+  CALL,             // argument count
+  INVOKE,           // argument count -- after a GET_METHOD
+  TAIL_CALL,        // argument count -- a CALL that is returned
+  TAIL_INVOKE,      // argument count -- an INVOKE that is returned
+  FUNCTION,         // function       -- push a new LoxFunction
+  CLASS,            // class          -- push a new LoxClass
+  INHERIT,          //                -- scope holding the superclass
+  BEGIN_SCOPE,
+  END_SCOPE,
+  RETURN
+};
+
+struct Chunk;
+
+// A function declaration along with its compiled body. Every
+// LoxFunction created from the declaration shares the same chunk.
+struct FunctionPrototype {
+  Function* declaration;
+  std::shared_ptr<const Chunk> chunk;
+};
+
+struct ClassPrototype {
+  Class* declaration;
+  std::vector<FunctionPrototype> methods;
+};
+
+// The compiled code of a script or of a function body. Every byte of
+// code records the token it was compiled from, in the same way clox
+// records line numbers, so runtime errors can still be reported
+// against the right token.
+struct Chunk {
+  std::vector<std::uint8_t> code;
+  std::vector<const Token*> tokens;
+  std::vector<Value> constants;
+  std::vector<FunctionPrototype> functions;
+  std::vector<ClassPrototype> classes;
+
+  // The inline caches of the property accesses the code was compiled
+  // from, which live on the AST nodes.
+  std::vector<PropertyCache*> caches;
+
+  void write(std::uint8_t byte, const Token* token) {
+    code.push_back(byte);
+    tokens.push_back(token);
+  }
+};
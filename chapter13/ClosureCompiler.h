@@ -0,0 +1,554 @@
+#pragma once
+
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>        // std::move
+#include <vector>
+#include "Completion.h"
+#include "Environment.h"
+#include "Error.h"
+#include "Expr.h"
+#include "Heap.h"
+#include "Interpreter.h"
+#include "LoxClass.h"
+#include "LoxFunction.h"
+#include "LoxInstance.h"
+#include "RuntimeError.h"
+#include "Stmt.h"
+#include "Value.h"
+
+// The Interpreter works out what to do with a node every time it
+// reaches it: accept() switches on the node's type, the visit method
+// switches on its operator, and variables check whether they are
+// local. The ClosureCompiler makes all of those decisions once. It
+// walks the resolved tree a single time and turns each node into a
+// lambda with its operator, slots and constants already picked out,
+// which calls the lambdas of its children directly. Running a program
+// is then only a matter of calling the closures of its statements.
+//
+// Compiled code runs on the Interpreter's runtime -- its environments,
+// globals and objects -- so both engines behave exactly alike.
+using CompiledExpr = std::function<Value()>;
+using CompiledStmt = std::function<Completion()>;
+using CompiledBlock = std::vector<CompiledStmt>;
+
+// A function whose body has been compiled to closures.
+class ClosureFunction: public LoxFunction {
+  std::shared_ptr<const CompiledBlock> body;
+
+protected:
+  Value execute(Interpreter& interpreter,
+                std::shared_ptr<Environment> environment) override;
+
+public:
+  ClosureFunction(Function* declaration,
+                  std::shared_ptr<Environment> closure,
+                  bool isInitializer,
+                  std::shared_ptr<const CompiledBlock> body)
+    : LoxFunction{declaration, std::move(closure), isInitializer},
+      body{std::move(body)}
+  {}
+
+  std::shared_ptr<LoxFunction> bind(
+      std::shared_ptr<LoxInstance> instance) override {
+    auto bound = std::make_shared<ClosureFunction>(*this);
+    bound->receiver = std::move(instance);
+    return bound;
+  }
+};
+
+class ClosureCompiler: public ExprVisitor<CompiledExpr>,
+                       public StmtVisitor<CompiledStmt> {
+friend class ClosureFunction;
+
+  // The closures hold on to the interpreter rather than to the
+  // compiler, which is gone by the time they run.
+  Interpreter& interpreter;
+
+public:
+  ClosureCompiler(Interpreter& interpreter)
+    : interpreter{interpreter}
+  {}
+
+  void interpret(const std::vector<Stmt*>& statements) {
+    CompiledBlock program = compile(statements);
+
+    try {
+      for (const CompiledStmt& statement : program) {
+        statement();
+      }
+    } catch (RuntimeError error) {
+      runtimeError(error);
+    }
+  }
+
+private:
+  CompiledExpr compile(Expr* expr) {
+    return expr->accept(*this);
+  }
+
+  CompiledStmt compile(Stmt* stmt) {
+    return stmt->accept(*this);
+  }
+
+  std::vector<CompiledExpr> compile(const std::vector<Expr*>& exprs) {
+    std::vector<CompiledExpr> compiled;
+    for (Expr* expr : exprs) {
+      compiled.push_back(compile(expr));
+    }
+
+    return compiled;
+  }
+
+  CompiledBlock compile(const std::vector<Stmt*>& stmts) {
+    CompiledBlock compiled;
+    for (Stmt* stmt : stmts) {
+      compiled.push_back(compile(stmt));
+    }
+
+    return compiled;
+  }
+
+  // Function bodies are shared by every LoxFunction created from the
+  // same declaration.
+  std::shared_ptr<const CompiledBlock> compileBody(Function* function) {
+    return std::make_shared<const CompiledBlock>(
+        compile(function->body));
+  }
+
+  static Completion executeBlock(
+      Interpreter& interpreter, const CompiledBlock& statements,
+      std::shared_ptr<Environment> environment) {
+    Interpreter::EnvironmentGuard guard{interpreter,
+                                        std::move(environment)};
+
+    for (const CompiledStmt& statement : statements) {
+      if (statement() == Completion::RETURN) return Completion::RETURN;
+    }
+
+    return Completion::NORMAL;
+  }
+
+  // Runs a function body, giving back what it returned.
+  static Value executeBody(Interpreter& interpreter,
+                           const CompiledBlock& body,
+                           std::shared_ptr<Environment> environment) {
+    Completion completion = executeBlock(interpreter, body,
+                                         std::move(environment));
+    if (completion == Completion::RETURN) {
+      return std::move(interpreter.returnValue);
+    }
+
+    return nullptr;
+  }
+
+public:
+  CompiledStmt visitBlockStmt(Block* stmt) override {
+    return [&in = interpreter, statements = compile(stmt->statements)] {
+      auto environment = std::make_shared<Environment>(in.environment);
+      return executeBlock(in, statements, std::move(environment));
+    };
+  }
+
+  CompiledStmt visitClassStmt(Class* stmt) override {
+    CompiledExpr superclass = nullptr;
+    if (stmt->superclass != nullptr) {
+      superclass = compile(stmt->superclass);
+    }
+
+    using Method = std::pair<Function*,
+                             std::shared_ptr<const CompiledBlock>>;
+    std::vector<Method> methods;
+    for (Function* method : stmt->methods) {
+      methods.emplace_back(method, compileBody(method));
+    }
+
+    return [&in = interpreter, stmt, superclass = std::move(superclass),
+            methods = std::move(methods)] {
+      std::shared_ptr<LoxClass> superklass = nullptr;
+      if (superclass) {
+        Value value = superclass();
+        if (!value.isClass()) {
+          throw RuntimeError(stmt->superclass->name,
+              "Superclass must be a class.");
+        }
+
+        superklass = value.asClass();
+        in.environment = std::make_shared<Environment>(in.environment);
+        in.environment->define(std::move(value));
+      }
+
+      std::map<std::string, std::shared_ptr<LoxFunction>> functions;
+      for (const auto& [method, body] : methods) {
+        functions[std::string{method->name.lexeme}] =
+            std::make_shared<ClosureFunction>(method, in.environment,
+                method->name.lexeme == "init", body);
+      }
+
+      auto klass = std::make_shared<LoxClass>(
+          std::string{stmt->name.lexeme}, superklass, functions);
+
+      if (superklass != nullptr) {
+        in.environment = in.environment->enclosing;
+      }
+
+      in.define(stmt->name, std::move(klass));
+      return Completion::NORMAL;
+    };
+  }
+
+  CompiledStmt visitExpressionStmt(Expression* stmt) override {
+    return [expression = compile(stmt->expression)] {
+      expression();
+      return Completion::NORMAL;
+    };
+  }
+
+  CompiledStmt visitFunctionStmt(Function* stmt) override {
+    return [&in = interpreter, stmt, body = compileBody(stmt)] {
+      std::shared_ptr<LoxFunction> function =
+          std::make_shared<ClosureFunction>(stmt, in.environment, false,
+                                            body);
+      in.define(stmt->name, std::move(function));
+      return Completion::NORMAL;
+    };
+  }
+
+  CompiledStmt visitIfStmt(If* stmt) override {
+    CompiledExpr condition = compile(stmt->condition);
+    CompiledStmt thenBranch = compile(stmt->thenBranch);
+
+    if (stmt->elseBranch == nullptr) {
+      return [&in = interpreter, condition = std::move(condition),
+              thenBranch = std::move(thenBranch)] {
+        if (in.isTruthy(condition())) return thenBranch();
+        return Completion::NORMAL;
+      };
+    }
+
+    return [&in = interpreter, condition = std::move(condition),
+            thenBranch = std::move(thenBranch),
+            elseBranch = compile(stmt->elseBranch)] {
+      if (in.isTruthy(condition())) return thenBranch();
+      return elseBranch();
+    };
+  }
+
+  CompiledStmt visitPrintStmt(Print* stmt) override {
+    return [&in = interpreter, expression = compile(stmt->expression)] {
+      in.print(expression());
+      return Completion::NORMAL;
+    };
+  }
+
+  CompiledStmt visitReturnStmt(Return* stmt) override {
+    if (stmt->value == nullptr) {
+      return [&in = interpreter] {
+        in.returnValue = nullptr;
+        return Completion::RETURN;
+      };
+    }
+
+    return [&in = interpreter, value = compile(stmt->value)] {
+      in.returnValue = value();
+      return Completion::RETURN;
+    };
+  }
+
+  CompiledStmt visitVarStmt(Var* stmt) override {
+    if (stmt->initializer == nullptr) {
+      return [&in = interpreter, &name = stmt->name] {
+        in.define(name, nullptr);
+        return Completion::NORMAL;
+      };
+    }
+
+    return [&in = interpreter, &name = stmt->name,
+            initializer = compile(stmt->initializer)] {
+      in.define(name, initializer());
+      return Completion::NORMAL;
+    };
+  }
+
+  CompiledStmt visitWhileStmt(While* stmt) override {
+    return [&in = interpreter, condition = compile(stmt->condition),
+            body = compile(stmt->body)] {
+      while (in.isTruthy(condition())) {
+        heap.collectIfNeeded();
+        if (body() == Completion::RETURN) return Completion::RETURN;
+      }
+
+      return Completion::NORMAL;
+    };
+  }
+
+  CompiledExpr visitAssignExpr(Assign* expr) override {
+    CompiledExpr value = compile(expr->value);
+
+    if (expr->depth >= 0) {
+      return [&in = interpreter, value = std::move(value),
+              depth = expr->depth, slot = expr->slot] {
+        Value result = value();
+        in.environment->assignAt(depth, slot, result);
+        return result;
+      };
+    }
+
+    return [&in = interpreter, value = std::move(value),
+            slot = interpreter.globalSlot(expr->name, expr->slot),
+            &name = expr->name] {
+      Value result = value();
+      in.globals.assign(slot, name, result);
+      return result;
+    };
+  }
+
+  CompiledExpr visitBinaryExpr(Binary* expr) override {
+    switch (expr->op.type) {
+      case BANG_EQUAL:
+        return [&in = interpreter, left = compile(expr->left),
+                right = compile(expr->right)] {
+          Value a = left();
+          Value b = right();
+          return Value{!in.isEqual(a, b)};
+        };
+      case EQUAL_EQUAL:
+        return [&in = interpreter, left = compile(expr->left),
+                right = compile(expr->right)] {
+          Value a = left();
+          Value b = right();
+          return Value{in.isEqual(a, b)};
+        };
+      case GREATER: return numeric(expr, std::greater<double>{});
+      case GREATER_EQUAL:
+        return numeric(expr, std::greater_equal<double>{});
+      case LESS: return numeric(expr, std::less<double>{});
+      case LESS_EQUAL: return numeric(expr, std::less_equal<double>{});
+      case MINUS: return numeric(expr, std::minus<double>{});
+      case PLUS:
+        return [left = compile(expr->left),
+                right = compile(expr->right), &op = expr->op] {
+          Value a = left();
+          Value b = right();
+
+          if (a.isNumber() && b.isNumber()) {
+            return Value{a.asNumber() + b.asNumber()};
+          }
+
+          if (a.isString() && b.isString()) {
+            return Value{a.asString() + b.asString()};
+          }
+
+          throw RuntimeError{op,
+              "Operands must be two numbers or two strings."};
+        };
+      case SLASH: return numeric(expr, std::divides<double>{});
+      case STAR: return numeric(expr, std::multiplies<double>{});
+    }
+
+    // Unreachable.
+    return nullptr;
+  }
+
+  CompiledExpr visitCallExpr(Call* expr) override {
+    // Methods called right away are invoked on their instance without
+    // being bound, as in the Interpreter.
+    switch (expr->callee->type) {
+      case ExprType::GET: return invokeGet(expr);
+      case ExprType::SUPER: return invokeSuper(expr);
+      default: break;
+    }
+
+    return [&in = interpreter, callee = compile(expr->callee),
+            arguments = compile(expr->arguments),
+            &paren = expr->paren, tail = expr->tail] {
+      Value function = callee();
+
+      Interpreter::ArgumentFrame frame{in};
+      for (const CompiledExpr& argument : arguments) {
+        frame.push(argument());
+      }
+
+      return in.call(function, frame.arguments(), paren, tail);
+    };
+  }
+
+  CompiledExpr visitGetExpr(Get* expr) override {
+    return [object = compile(expr->object), &name = expr->name,
+            &cache = expr->cache] {
+      Value value = object();
+      if (value.isInstance()) {
+        return value.asInstance()->get(name, cache);
+      }
+
+      throw RuntimeError(name, "Only instances have properties.");
+    };
+  }
+
+  // A grouping only affects how the tree was parsed, so it compiles
+  // to nothing more than its expression.
+  CompiledExpr visitGroupingExpr(Grouping* expr) override {
+    return compile(expr->expression);
+  }
+
+  CompiledExpr visitLiteralExpr(Literal* expr) override {
+    return [value = expr->value] {
+      return value;
+    };
+  }
+
+  CompiledExpr visitLogicalExpr(Logical* expr) override {
+    if (expr->op.type == OR) {
+      return [&in = interpreter, left = compile(expr->left),
+              right = compile(expr->right)] {
+        Value value = left();
+        if (in.isTruthy(value)) return value;
+        return right();
+      };
+    }
+
+    return [&in = interpreter, left = compile(expr->left),
+            right = compile(expr->right)] {
+      Value value = left();
+      if (!in.isTruthy(value)) return value;
+      return right();
+    };
+  }
+
+  CompiledExpr visitSetExpr(Set* expr) override {
+    return [object = compile(expr->object), &name = expr->name,
+            value = compile(expr->value), &cache = expr->cache] {
+      Value instance = object();
+
+      if (!instance.isInstance()) {
+        throw RuntimeError(name, "Only instances have fields.");
+      }
+
+      Value result = value();
+      instance.asInstance()->set(name, result, cache);
+      return result;
+    };
+  }
+
+  // There is nothing to decide ahead of time for "super", so it runs
+  // the Interpreter's own code.
+  CompiledExpr visitSuperExpr(Super* expr) override {
+    return [&in = interpreter, expr] {
+      return in.visitSuperExpr(expr);
+    };
+  }
+
+  CompiledExpr visitThisExpr(This* expr) override {
+    return variable(expr->keyword, expr->depth, expr->slot);
+  }
+
+  CompiledExpr visitUnaryExpr(Unary* expr) override {
+    switch (expr->op.type) {
+      case BANG:
+        return [&in = interpreter, right = compile(expr->right)] {
+          return Value{!in.isTruthy(right())};
+        };
+      case MINUS:
+        return [&in = interpreter, right = compile(expr->right),
+                &op = expr->op] {
+          Value value = right();
+          in.checkNumberOperand(op, value);
+          return Value{-value.asNumber()};
+        };
+    }
+
+    // Unreachable.
+    return nullptr;
+  }
+
+  CompiledExpr visitVariableExpr(Variable* expr) override {
+    return variable(expr->name, expr->depth, expr->slot);
+  }
+
+private:
+  CompiledExpr invokeGet(Call* expr) {
+    auto get = static_cast<Get*>(expr->callee);
+
+    return [&in = interpreter, object = compile(get->object),
+            arguments = compile(expr->arguments), &name = get->name,
+            &cache = get->cache, &paren = expr->paren,
+            tail = expr->tail] {
+      Value value = object();
+      if (!value.isInstance()) {
+        throw RuntimeError(name, "Only instances have properties.");
+      }
+
+      const std::shared_ptr<LoxInstance>& instance = value.asInstance();
+      std::shared_ptr<LoxFunction> method =
+          instance->getMethod(name, cache);
+
+      Value field;
+      if (method == nullptr) field = instance->get(name, cache);
+
+      Interpreter::ArgumentFrame frame{in};
+      for (const CompiledExpr& argument : arguments) {
+        frame.push(argument());
+      }
+
+      if (method != nullptr) {
+        return in.invoke(std::move(method), instance,
+                         frame.arguments(), paren, tail);
+      }
+
+      return in.call(field, frame.arguments(), paren, tail);
+    };
+  }
+
+  CompiledExpr invokeSuper(Call* expr) {
+    auto callee = static_cast<Super*>(expr->callee);
+
+    return [&in = interpreter, callee, &paren = expr->paren,
+            arguments = compile(expr->arguments), tail = expr->tail] {
+      std::shared_ptr<LoxInstance> instance;
+      std::shared_ptr<LoxFunction> method =
+          in.superMethod(callee, instance);
+
+      Interpreter::ArgumentFrame frame{in};
+      for (const CompiledExpr& argument : arguments) {
+        frame.push(argument());
+      }
+
+      return in.invoke(std::move(method), std::move(instance),
+                       frame.arguments(), paren, tail);
+    };
+  }
+
+  template <class Op>
+  CompiledExpr numeric(Binary* expr, Op op) {
+    return [&in = interpreter, left = compile(expr->left),
+            right = compile(expr->right), &token = expr->op, op] {
+      Value a = left();
+      Value b = right();
+      in.checkNumberOperands(token, a, b);
+      return Value{op(a.asNumber(), b.asNumber())};
+    };
+  }
+
+  CompiledExpr variable(const Token& name, int depth, int& slot) {
+    if (depth >= 0) {
+      return [&in = interpreter, depth, slot] {
+        return in.environment->getAt(depth, slot);
+      };
+    }
+
+    return [&in = interpreter,
+            slot = interpreter.globalSlot(name, slot), &name] {
+      return in.globals.get(slot, name);
+    };
+  }
+};
+
+inline Value ClosureFunction::execute(
+    Interpreter& interpreter,
+    std::shared_ptr<Environment> environment) {
+  return ClosureCompiler::executeBody(interpreter, *body,
+                                     std::move(environment));
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+// How a statement finished running. A return statement finishes with
+// RETURN, which every statement around it passes straight up until
+// the function call that is returning is reached. The value being
+// returned waits in the Interpreter in the meantime.
+//
+// Returning this way costs no more than any other statement, where
+// throwing the value up to the call would unwind the C++ stack.
+enum class Completion {
+  NORMAL,
+  RETURN
+};
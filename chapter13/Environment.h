@@ -1,19 +1,23 @@
 #pragma once
 
-#include <any>
-#include <functional> // less
-#include <map>
 #include <memory>
-#include <string>
 #include <utility>    // std::move
-#include "Error.h"
-#include "Token.h"
+#include <vector>
+#include "Heap.h"
+#include "Value.h"
 
-class Environment: public std::enable_shared_from_this<Environment> {
+class Environment: public Traced {
+  friend class ClosureCompiler;
   friend class Interpreter;
+  friend class VM;
 
   std::shared_ptr<Environment> enclosing;
-  std::map<std::string, std::any> values;
+
+  // The Resolver gives every local variable a slot number matching
+  // the order in which it was declared in its scope, and environments
+  // store their values in that order. Globals aren't kept in an
+  // environment at all; see Globals.h.
+  std::vector<Value> slots;
 
 public:
   Environment()
@@ -24,52 +28,44 @@ public:
     : enclosing{std::move(enclosing)}
   {}
 
-  std::any get(const Token& name) {
-    auto elem = values.find(name.lexeme);
-    if (elem != values.end()) {
-      return elem->second;
-    }
-
-    if (enclosing != nullptr) return enclosing->get(name);
-
-    throw RuntimeError(name,
-        "Undefined variable '" + name.lexeme + "'.");
+  // Makes room for the given number of locals up front, so defining
+  // them never has to grow the slots.
+  Environment(std::shared_ptr<Environment> enclosing, int size)
+    : enclosing{std::move(enclosing)}
+  {
+    slots.reserve(size);
   }
 
-  void assign(const Token& name, std::any value) {
-    auto elem = values.find(name.lexeme);
-    if (elem != values.end()) {
-      elem->second = std::move(value);
-      return;
-    }
+  // Locals are defined in the same order the Resolver declared them,
+  // so the next free slot is always the right one.
+  void define(Value value) {
+    slots.push_back(std::move(value));
+  }
 
-    if (enclosing != nullptr) {
-      enclosing->assign(name, std::move(value));
-      return;
+  Environment* ancestor(int distance) {
+    Environment* environment = this;
+    for (int i = 0; i < distance; ++i) {
+      environment = environment->enclosing.get();
     }
 
-    throw RuntimeError(name,
-        "Undefined variable '" + name.lexeme + "'.");
+    return environment;
   }
 
-  void define(const std::string& name, std::any value) {
-    values[name] = std::move(value);
+  Value getAt(int distance, int slot) {
+    return ancestor(distance)->slots[slot];
   }
 
-  std::shared_ptr<Environment> ancestor(int distance) {
-    std::shared_ptr<Environment> environment = shared_from_this();
-    for (int i = 0; i < distance; ++i) {
-      environment = environment->enclosing;
-    }
-
-    return environment;
+  void assignAt(int distance, int slot, Value value) {
+    ancestor(distance)->slots[slot] = std::move(value);
   }
 
-  std::any getAt(int distance, const std::string& name) {
-    return ancestor(distance)->values[name];
+  void trace(Tracer& tracer) override {
+    if (enclosing != nullptr) tracer.visit(enclosing.get());
+    for (const Value& value : slots) tracer.visit(value);
   }
 
-  void assignAt(int distance, const Token& name, std::any value) {
-    ancestor(distance)->values[name.lexeme] = std::move(value);
+  void clear() override {
+    enclosing = nullptr;
+    slots.clear();
   }
-};
+};
\ No newline at end of file
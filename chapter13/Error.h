@@ -1,35 +1,53 @@
 #pragma once
 
 #include <iostream>
+#include <string>
 #include <string_view>
 #include "RuntimeError.h"
+#include "SourceManager.h"
 #include "Token.h"
 
 inline bool hadError = false;
 inline bool hadRuntimeError = false;
 
-static void report(int line, std::string_view where,
+// The line and column of a lexeme, or just the line for one that
+// isn't in any of the sources.
+static std::string locate(int line, const char* position) {
+  SourceManager::Location location = sources.locate(position);
+  if (location.line == 0) return std::to_string(line);
+  return std::to_string(location.line) + ":" +
+         std::to_string(location.column);
+}
+
+static void report(const std::string& location, std::string_view where,
                    std::string_view message) {
   std::cerr <<
-      "[line " << line << "] Error" << where << ": " << message <<
+      "[line " << location << "] Error" << where << ": " << message <<
       "\n";
   hadError = true;
 }
 
 void error(const Token& token, std::string_view message) {
+  std::string location = locate(token.line, token.lexeme.data());
   if (token.type == END_OF_FILE) {
-    report(token.line, " at end", message);
+    report(location, " at end", message);
   } else {
-    report(token.line, " at '" + token.lexeme + "'", message);
+    report(location, " at '" + std::string{token.lexeme} + "'",
+           message);
   }
 }
 
 void error(int line, std::string_view message) {
-  report(line, "", message);
+  report(std::to_string(line), "", message);
+}
+
+// For the scanner, which has no token yet.
+void error(int line, const char* position, std::string_view message) {
+  report(locate(line, position), "", message);
 }
 
 void runtimeError(const RuntimeError& error) {
-  std::cerr << error.what() <<
-      "\n[line " << error.token.line << "]\n";
+  std::cerr << error.what() << "\n[line " <<
+      locate(error.token.line, error.token.lexeme.data()) << "]\n";
   hadRuntimeError = true;
 }
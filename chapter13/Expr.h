@@ -1,11 +1,12 @@
 #pragma once
 
-#include <any>
-#include <memory>
 #include <utility>  // std::move
 #include <vector>
 #include "Token.h"
+#include "Value.h"
 
+#include "Shape.h"
+#include "Specialization.h"
 
 struct Assign;
 struct Binary;
@@ -20,179 +21,211 @@ struct This;
 struct Unary;
 struct Variable;
 
+enum class ExprType {
+  ASSIGN,
+  BINARY,
+  CALL,
+  GET,
+  GROUPING,
+  LITERAL,
+  LOGICAL,
+  SET,
+  SUPER,
+  THIS,
+  UNARY,
+  VARIABLE,
+};
+
+template <class R>
 struct ExprVisitor {
-  virtual std::any visitAssignExpr(std::shared_ptr<Assign> expr) = 0;
-  virtual std::any visitBinaryExpr(std::shared_ptr<Binary> expr) = 0;
-  virtual std::any visitCallExpr(std::shared_ptr<Call> expr) = 0;
-  virtual std::any visitGetExpr(std::shared_ptr<Get> expr) = 0;
-  virtual std::any visitGroupingExpr(std::shared_ptr<Grouping> expr) = 0;
-  virtual std::any visitLiteralExpr(std::shared_ptr<Literal> expr) = 0;
-  virtual std::any visitLogicalExpr(std::shared_ptr<Logical> expr) = 0;
-  virtual std::any visitSetExpr(std::shared_ptr<Set> expr) = 0;
-  virtual std::any visitSuperExpr(std::shared_ptr<Super> expr) = 0;
-  virtual std::any visitThisExpr(std::shared_ptr<This> expr) = 0;
-  virtual std::any visitUnaryExpr(std::shared_ptr<Unary> expr) = 0;
-  virtual std::any visitVariableExpr(std::shared_ptr<Variable> expr) = 0;
+  virtual R visitAssignExpr(Assign* expr) = 0;
+  virtual R visitBinaryExpr(Binary* expr) = 0;
+  virtual R visitCallExpr(Call* expr) = 0;
+  virtual R visitGetExpr(Get* expr) = 0;
+  virtual R visitGroupingExpr(Grouping* expr) = 0;
+  virtual R visitLiteralExpr(Literal* expr) = 0;
+  virtual R visitLogicalExpr(Logical* expr) = 0;
+  virtual R visitSetExpr(Set* expr) = 0;
+  virtual R visitSuperExpr(Super* expr) = 0;
+  virtual R visitThisExpr(This* expr) = 0;
+  virtual R visitUnaryExpr(Unary* expr) = 0;
+  virtual R visitVariableExpr(Variable* expr) = 0;
   virtual ~ExprVisitor() = default;
 };
 
 struct Expr {
-  virtual std::any accept(ExprVisitor& visitor) = 0;
-};
+  const ExprType type;
 
-struct Assign: Expr, public std::enable_shared_from_this<Assign> {
-  Assign(Token name, std::shared_ptr<Expr> value)
-    : name{std::move(name)}, value{std::move(value)}
+  template <class R>
+  R accept(ExprVisitor<R>& visitor);
+
+protected:
+  Expr(ExprType type)
+    : type{type}
   {}
+};
 
-  std::any accept(ExprVisitor& visitor) override {
-    return visitor.visitAssignExpr(shared_from_this());
-  }
+struct Assign: Expr {
+  Assign(Token name, Expr* value)
+    : Expr{ExprType::ASSIGN}, name{std::move(name)}, value{std::move(value)}
+  {}
 
   const Token name;
-  const std::shared_ptr<Expr> value;
+  Expr* const value;
+
+  int depth = -1;
+  int slot = -1;
 };
 
-struct Binary: Expr, public std::enable_shared_from_this<Binary> {
-  Binary(std::shared_ptr<Expr> left, Token op, std::shared_ptr<Expr> right)
-    : left{std::move(left)}, op{std::move(op)}, right{std::move(right)}
+struct Binary: Expr {
+  Binary(Expr* left, Token op, Expr* right)
+    : Expr{ExprType::BINARY}, left{std::move(left)}, op{std::move(op)}, right{std::move(right)}
   {}
 
-  std::any accept(ExprVisitor& visitor) override {
-    return visitor.visitBinaryExpr(shared_from_this());
-  }
-
-  const std::shared_ptr<Expr> left;
+  Expr* const left;
   const Token op;
-  const std::shared_ptr<Expr> right;
+  Expr* const right;
+
+  Specialization specialized = Specialization::UNINITIALIZED;
 };
 
-struct Call: Expr, public std::enable_shared_from_this<Call> {
-  Call(std::shared_ptr<Expr> callee, Token paren, std::vector<std::shared_ptr<Expr>> arguments)
-    : callee{std::move(callee)}, paren{std::move(paren)}, arguments{std::move(arguments)}
+struct Call: Expr {
+  Call(Expr* callee, Token paren, std::vector<Expr*> arguments)
+    : Expr{ExprType::CALL}, callee{std::move(callee)}, paren{std::move(paren)}, arguments{std::move(arguments)}
   {}
 
-  std::any accept(ExprVisitor& visitor) override {
-    return visitor.visitCallExpr(shared_from_this());
-  }
-
-  const std::shared_ptr<Expr> callee;
+  Expr* const callee;
   const Token paren;
-  const std::vector<std::shared_ptr<Expr>> arguments;
+  const std::vector<Expr*> arguments;
+
+  bool tail = false;
 };
 
-struct Get: Expr, public std::enable_shared_from_this<Get> {
-  Get(std::shared_ptr<Expr> object, Token name)
-    : object{std::move(object)}, name{std::move(name)}
+struct Get: Expr {
+  Get(Expr* object, Token name)
+    : Expr{ExprType::GET}, object{std::move(object)}, name{std::move(name)}
   {}
 
-  std::any accept(ExprVisitor& visitor) override {
-    return visitor.visitGetExpr(shared_from_this());
-  }
-
-  const std::shared_ptr<Expr> object;
+  Expr* const object;
   const Token name;
+
+  PropertyCache cache;
 };
 
-struct Grouping: Expr, public std::enable_shared_from_this<Grouping> {
-  Grouping(std::shared_ptr<Expr> expression)
-    : expression{std::move(expression)}
+struct Grouping: Expr {
+  Grouping(Expr* expression)
+    : Expr{ExprType::GROUPING}, expression{std::move(expression)}
   {}
 
-  std::any accept(ExprVisitor& visitor) override {
-    return visitor.visitGroupingExpr(shared_from_this());
-  }
-
-  const std::shared_ptr<Expr> expression;
+  Expr* const expression;
 };
 
-struct Literal: Expr, public std::enable_shared_from_this<Literal> {
-  Literal(std::any value)
-    : value{std::move(value)}
+struct Literal: Expr {
+  Literal(Value value)
+    : Expr{ExprType::LITERAL}, value{std::move(value)}
   {}
 
-  std::any accept(ExprVisitor& visitor) override {
-    return visitor.visitLiteralExpr(shared_from_this());
-  }
-
-  const std::any value;
+  const Value value;
 };
 
-struct Logical: Expr, public std::enable_shared_from_this<Logical> {
-  Logical(std::shared_ptr<Expr> left, Token op, std::shared_ptr<Expr> right)
-    : left{std::move(left)}, op{std::move(op)}, right{std::move(right)}
+struct Logical: Expr {
+  Logical(Expr* left, Token op, Expr* right)
+    : Expr{ExprType::LOGICAL}, left{std::move(left)}, op{std::move(op)}, right{std::move(right)}
   {}
 
-  std::any accept(ExprVisitor& visitor) override {
-    return visitor.visitLogicalExpr(shared_from_this());
-  }
-
-  const std::shared_ptr<Expr> left;
+  Expr* const left;
   const Token op;
-  const std::shared_ptr<Expr> right;
+  Expr* const right;
+
+  Specialization specialized = Specialization::UNINITIALIZED;
 };
 
-struct Set: Expr, public std::enable_shared_from_this<Set> {
-  Set(std::shared_ptr<Expr> object, Token name, std::shared_ptr<Expr> value)
-    : object{std::move(object)}, name{std::move(name)}, value{std::move(value)}
+struct Set: Expr {
+  Set(Expr* object, Token name, Expr* value)
+    : Expr{ExprType::SET}, object{std::move(object)}, name{std::move(name)}, value{std::move(value)}
   {}
 
-  std::any accept(ExprVisitor& visitor) override {
-    return visitor.visitSetExpr(shared_from_this());
-  }
-
-  const std::shared_ptr<Expr> object;
+  Expr* const object;
   const Token name;
-  const std::shared_ptr<Expr> value;
+  Expr* const value;
+
+  PropertyCache cache;
 };
 
-struct Super: Expr, public std::enable_shared_from_this<Super> {
+struct Super: Expr {
   Super(Token keyword, Token method)
-    : keyword{std::move(keyword)}, method{std::move(method)}
+    : Expr{ExprType::SUPER}, keyword{std::move(keyword)}, method{std::move(method)}
   {}
 
-  std::any accept(ExprVisitor& visitor) override {
-    return visitor.visitSuperExpr(shared_from_this());
-  }
-
   const Token keyword;
   const Token method;
+
+  int depth = -1;
+  int slot = -1;
 };
 
-struct This: Expr, public std::enable_shared_from_this<This> {
+struct This: Expr {
   This(Token keyword)
-    : keyword{std::move(keyword)}
+    : Expr{ExprType::THIS}, keyword{std::move(keyword)}
   {}
 
-  std::any accept(ExprVisitor& visitor) override {
-    return visitor.visitThisExpr(shared_from_this());
-  }
-
   const Token keyword;
+
+  int depth = -1;
+  int slot = -1;
 };
 
-struct Unary: Expr, public std::enable_shared_from_this<Unary> {
-  Unary(Token op, std::shared_ptr<Expr> right)
-    : op{std::move(op)}, right{std::move(right)}
+struct Unary: Expr {
+  Unary(Token op, Expr* right)
+    : Expr{ExprType::UNARY}, op{std::move(op)}, right{std::move(right)}
   {}
 
-  std::any accept(ExprVisitor& visitor) override {
-    return visitor.visitUnaryExpr(shared_from_this());
-  }
-
   const Token op;
-  const std::shared_ptr<Expr> right;
+  Expr* const right;
+
+  Specialization specialized = Specialization::UNINITIALIZED;
 };
 
-struct Variable: Expr, public std::enable_shared_from_this<Variable> {
+struct Variable: Expr {
   Variable(Token name)
-    : name{std::move(name)}
+    : Expr{ExprType::VARIABLE}, name{std::move(name)}
   {}
 
-  std::any accept(ExprVisitor& visitor) override {
-    return visitor.visitVariableExpr(shared_from_this());
-  }
-
   const Token name;
+
+  int depth = -1;
+  int slot = -1;
 };
 
+template <class R>
+R Expr::accept(ExprVisitor<R>& visitor) {
+  switch (type) {
+    case ExprType::ASSIGN:
+      return visitor.visitAssignExpr(static_cast<Assign*>(this));
+    case ExprType::BINARY:
+      return visitor.visitBinaryExpr(static_cast<Binary*>(this));
+    case ExprType::CALL:
+      return visitor.visitCallExpr(static_cast<Call*>(this));
+    case ExprType::GET:
+      return visitor.visitGetExpr(static_cast<Get*>(this));
+    case ExprType::GROUPING:
+      return visitor.visitGroupingExpr(static_cast<Grouping*>(this));
+    case ExprType::LITERAL:
+      return visitor.visitLiteralExpr(static_cast<Literal*>(this));
+    case ExprType::LOGICAL:
+      return visitor.visitLogicalExpr(static_cast<Logical*>(this));
+    case ExprType::SET:
+      return visitor.visitSetExpr(static_cast<Set*>(this));
+    case ExprType::SUPER:
+      return visitor.visitSuperExpr(static_cast<Super*>(this));
+    case ExprType::THIS:
+      return visitor.visitThisExpr(static_cast<This*>(this));
+    case ExprType::UNARY:
+      return visitor.visitUnaryExpr(static_cast<Unary*>(this));
+    case ExprType::VARIABLE:
+      return visitor.visitVariableExpr(static_cast<Variable*>(this));
+  }
+
+  // Unreachable.
+  return R();
+}
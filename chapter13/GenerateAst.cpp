@@ -1,5 +1,5 @@
 #include <algorithm>       // std::find_if_not
-#include <cctype>          // std::tolower, std::isspace
+#include <cctype>          // std::tolower, std::toupper, std::isspace
 #include <fstream>
 #include <iostream>
 #include <sstream>
@@ -49,45 +49,46 @@ std::string toLowerCase(std::string_view str) {
 }
 
 // In C++ we cannot rely on garbage collection to clean up our pointer
-// messes for us. Instead of having to worry about calling delete
-// every time we're done with some heap memory, we can dump this job
-// onto std::shared_ptr. This function lets us use a '*' in our
-// metaprogram to indicate that we actually want a smart pointer.
-std::string fix_pointer(std::string_view field) {
+// messes for us. Every node is allocated from the Arena of the
+// compilation unit it belongs to, which frees the whole tree at once,
+// so the nodes can simply point to each other with plain pointers.
+// The pointers themselves are const, but the nodes they point to are
+// not, since later passes annotate them.
+std::string constField(std::string_view field) {
   std::ostringstream out;
   std::string_view type = split(field, " ")[0];
   std::string_view name = split(field, " ")[1];
-  bool close_bracket = false;
-
-  if (type.substr(0, 12) == "std::vector<") {
-    out << "std::vector<";
-    type = type.substr(12, type.length() - 13); // ignores closing '>'
-    close_bracket = true;
-  }
 
   if (type.back() == '*') {
-    type.remove_suffix(1);
-    out << "std::shared_ptr<" << type << ">";
+    out << type << " const " << name;
   } else {
-    out << type;
+    out << "const " << type << " " << name;
   }
 
-  if (close_bracket) out << ">";
-  out << " " << name;
-
   return out.str();
 }
 
+std::string toUpperCase(std::string_view str) {
+  std::string out;
+
+  for (char c : str) {
+    out.push_back(std::toupper(c));
+  }
+
+  return out;
+}
+
 void defineVisitor(
     std::ofstream& writer, std::string_view baseName,
     const std::vector<std::string_view>& types) {
-  writer << "struct " << baseName << "Visitor {\n";
+  writer << "template <class R>\n"
+            "struct " << baseName << "Visitor {\n";
 
   for (std::string_view type : types) {
       std::string_view typeName = trim(split(type, ":")[0]);
-      writer << "  virtual std::any visit" << typeName << baseName <<
-                "(std::shared_ptr<" << typeName << "> " <<
-                toLowerCase(baseName) << ") = 0;\n";
+      writer << "  virtual R visit" << typeName << baseName <<
+                "(" << typeName << "* " << toLowerCase(baseName) <<
+                ") = 0;\n";
   }
 
   writer << "  virtual ~" << baseName << "Visitor() = default;\n";
@@ -97,52 +98,75 @@ void defineVisitor(
 void defineType(
     std::ofstream& writer, std::string_view baseName,
     std::string_view className, std::string_view fieldList) {
-  writer << "struct " << className << ": " << baseName <<
-            ", public std::enable_shared_from_this<" <<
-            className << "> {\n";
+  writer << "struct " << className << ": " << baseName << " {\n";
+
+  // Fields listed after a '|' are filled in by later passes rather
+  // than by the parser, so they are left out of the constructor and
+  // aren't const. Each one is written with its initial value.
+  std::vector<std::string_view> parts = split(fieldList, " | ");
+  std::vector<std::string_view> fields = split(parts[0], ", ");
+  std::vector<std::string_view> annotations;
+  if (parts.size() > 1) annotations = split(parts[1], ", ");
 
   // Constructor.
   writer << "  " << className << "(";
 
-  std::vector<std::string_view> fields = split(fieldList, ", ");
-  writer << fix_pointer(fields[0]);
+  writer << fields[0];
 
   for (int i = 1; i < fields.size(); ++i) {
-    writer << ", " << fix_pointer(fields[i]);
+    writer << ", " << fields[i];
   }
 
   writer << ")\n"
-         << "    : ";
+         << "    : " << baseName << "{" << baseName << "Type::" <<
+                toUpperCase(className) << "}";
 
   // Store parameters in fields.
-  std::string_view name = split(fields[0], " ")[1];
-  writer << name << "{std::move(" << name << ")}";
-
-  for (int i = 1; i < fields.size(); ++i) {
-    name = split(fields[i], " ")[1];
+  for (std::string_view field : fields) {
+    std::string_view name = split(field, " ")[1];
     writer << ", " << name << "{std::move(" << name << ")}";
   }
 
   writer << "\n"
          << "  {}\n";
 
-  // Visitor pattern.
-  writer << "\n"
-            "  std::any accept(" << baseName << "Visitor& visitor)"
-                " override {\n"
-            "    return visitor.visit" << className << baseName <<
-                "(shared_from_this());\n"
-            "  }\n";
-
   // Fields.
   writer << "\n";
   for (std::string_view field : fields) {
-    writer << "  const " << fix_pointer(field) << ";\n";
+    writer << "  " << constField(field) << ";\n";
+  }
+
+  if (!annotations.empty()) writer << "\n";
+  for (std::string_view annotation : annotations) {
+    writer << "  " << annotation << ";\n";
   }
 
   writer << "};\n\n";
 }
 
+void defineAccept(
+    std::ofstream& writer, std::string_view baseName,
+    const std::vector<std::string_view>& types) {
+  writer << "template <class R>\n"
+            "R " << baseName << "::accept(" << baseName <<
+                "Visitor<R>& visitor) {\n"
+            "  switch (type) {\n";
+
+  for (std::string_view type : types) {
+    std::string_view className = trim(split(type, ": ")[0]);
+    writer << "    case " << baseName << "Type::" <<
+                  toUpperCase(className) << ":\n"
+              "      return visitor.visit" << className << baseName <<
+                  "(static_cast<" << className << "*>(this));\n";
+  }
+
+  writer << "  }\n"
+            "\n"
+            "  // Unreachable.\n"
+            "  return R();\n"
+            "}\n";
+}
+
 void defineAst(
     const std::string& outputDir, const std::string& baseName,
     const std::vector<std::string_view>& types) {
@@ -151,13 +175,17 @@ void defineAst(
 
   writer << "#pragma once\n"
             "\n"
-            "#include <any>\n"
-            "#include <memory>\n"
             "#include <utility>  // std::move\n"
             "#include <vector>\n"
             "#include \"Token.h\"\n"
+            "#include \"Value.h\"\n"
             "\n";
 
+  if (baseName == "Expr") {
+    writer << "#include \"Shape.h\"\n"
+              "#include \"Specialization.h\"\n";
+  }
+
   if (baseName == "Stmt") writer << "#include \"Expr.h\"\n";
   writer << "\n";
 
@@ -167,21 +195,39 @@ void defineAst(
     writer << "struct " << className << ";\n";
   }
 
+  // Every node is tagged with its type.
+  writer << "\n"
+            "enum class " << baseName << "Type {\n";
+
+  for (std::string_view type : types) {
+    std::string_view className = trim(split(type, ": ")[0]);
+    writer << "  " << toUpperCase(className) << ",\n";
+  }
+
+  writer << "};\n";
+
   // Visitor.
   writer << "\n";
   defineVisitor(writer, baseName, types);
 
   // The base class.
-  // C++ does not allow virtual methods to be templated. That means
-  // multiple accept signatures are out -- at least if we don't want
-  // to over complicate things. An alternative is to use std::any,
-  // which holds values of any type in a type-safe way. Classes
-  // implementing the base class are then required to cast the return
-  // value to the expected type inside their member functions.
+  // C++ does not allow virtual methods to be templated, so a virtual
+  // accept() would have to return the same type for every visitor.
+  // Instead, visitors are templated on what they return -- Values for
+  // the interpreter, strings for the AST printer, nothing at all for
+  // statements -- and accept() is an ordinary template that switches
+  // on the node's type tag to pick the visit method.
   writer << "\n"
             "struct " << baseName << " {\n"
-            "  virtual std::any accept(" << baseName <<
-            "Visitor& visitor) = 0;\n"
+            "  const " << baseName << "Type type;\n"
+            "\n"
+            "  template <class R>\n"
+            "  R accept(" << baseName << "Visitor<R>& visitor);\n"
+            "\n"
+            "protected:\n"
+            "  " << baseName << "(" << baseName << "Type type)\n"
+            "    : type{type}\n"
+            "  {}\n"
             "};\n\n";
 
   // The AST classes.
@@ -190,6 +236,10 @@ void defineAst(
     std::string_view fields = trim(split(type, ": ")[1]);
     defineType(writer, baseName, className, fields);
   }
+
+  // The visitor pattern. It can only be defined once all the
+  // subclasses are complete.
+  defineAccept(writer, baseName, types);
 }
 
 int main(int argc, char* argv[]) {
@@ -199,20 +249,37 @@ int main(int argc, char* argv[]) {
   }
   std::string outputDir = argv[1];
 
+  // The Resolver stores where each variable lives in its depth and
+  // slot. A depth of -1 means the variable is global, in which case
+  // slot caches its index in the globals table once the interpreter
+  // has looked it up.
+  //
+  // Operators record the types of the operands they have seen so the
+  // interpreter can skip checks that have never failed, and property
+  // accesses cache where they last found their field.
   defineAst(outputDir, "Expr", {
-    "Assign   : Token name, Expr* value",
-    "Binary   : Expr* left, Token op, Expr* right",
+    "Assign   : Token name, Expr* value"
+              " | int depth = -1, int slot = -1",
+    "Binary   : Expr* left, Token op, Expr* right"
+              " | Specialization specialized ="
+              " Specialization::UNINITIALIZED",
     "Call     : Expr* callee, Token paren,"
-              " std::vector<Expr*> arguments",
-    "Get      : Expr* object, Token name",
+              " std::vector<Expr*> arguments | bool tail = false",
+    "Get      : Expr* object, Token name | PropertyCache cache",
     "Grouping : Expr* expression",
-    "Literal  : std::any value",
-    "Logical  : Expr* left, Token op, Expr* right",
-    "Set      : Expr* object, Token name, Expr* value",
-    "Super    : Token keyword, Token method",
-    "This     : Token keyword",
-    "Unary    : Token op, Expr* right",
-    "Variable : Token name"
+    "Literal  : Value value",
+    "Logical  : Expr* left, Token op, Expr* right"
+              " | Specialization specialized ="
+              " Specialization::UNINITIALIZED",
+    "Set      : Expr* object, Token name, Expr* value"
+              " | PropertyCache cache",
+    "Super    : Token keyword, Token method"
+              " | int depth = -1, int slot = -1",
+    "This     : Token keyword | int depth = -1, int slot = -1",
+    "Unary    : Token op, Expr* right"
+              " | Specialization specialized ="
+              " Specialization::UNINITIALIZED",
+    "Variable : Token name | int depth = -1, int slot = -1"
   });
 
   defineAst(outputDir, "Stmt", {
@@ -221,7 +288,7 @@ int main(int argc, char* argv[]) {
                 " std::vector<Function*> methods",
     "Expression : Expr* expression",
     "Function   : Token name, std::vector<Token> params,"
-                " std::vector<Stmt*> body",
+                " std::vector<Stmt*> body | int locals = 0",
     "If         : Expr* condition, Stmt* thenBranch,"
                 " Stmt* elseBranch",
     "Print      : Expr* expression",
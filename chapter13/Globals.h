@@ -0,0 +1,66 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>    // std::move
+#include <vector>
+#include "Error.h"
+#include "Token.h"
+#include "Value.h"
+
+// Global variables live in a single table indexed by slot. A name is
+// interned into a slot the first time anything refers to it, even if
+// it hasn't been defined yet, so a Variable or Assign node can cache
+// its slot and never look the name up again. Since the slot exists
+// before the variable does, each access still checks that the
+// variable has actually been defined.
+class Globals {
+  std::unordered_map<std::string, int> symbols;
+  std::vector<Value> values;
+  std::vector<bool> defined;
+
+public:
+  int intern(std::string_view name) {
+    std::string key{name};
+    auto elem = symbols.find(key);
+    if (elem != symbols.end()) return elem->second;
+
+    int slot = values.size();
+    symbols.emplace(std::move(key), slot);
+    values.emplace_back();
+    defined.push_back(false);
+    return slot;
+  }
+
+  Value get(int slot, const Token& name) {
+    if (defined[slot]) return values[slot];
+
+    throw RuntimeError(name,
+        "Undefined variable '" + std::string{name.lexeme} + "'.");
+  }
+
+  // Returns null if the variable hasn't been defined.
+  const Value* find(int slot) const {
+    return defined[slot] ? &values[slot] : nullptr;
+  }
+
+  void assign(int slot, const Token& name, Value value) {
+    if (defined[slot]) {
+      values[slot] = std::move(value);
+      return;
+    }
+
+    throw RuntimeError(name,
+        "Undefined variable '" + std::string{name.lexeme} + "'.");
+  }
+
+  void define(std::string_view name, Value value) {
+    define(intern(name), std::move(value));
+  }
+
+  void define(int slot, Value value) {
+    values[slot] = std::move(value);
+    defined[slot] = true;
+  }
+};
@@ -0,0 +1,14 @@
+#include "Heap.h"
+#include "LoxClass.h"
+#include "LoxFunction.h"
+#include "LoxInstance.h"
+#include "Value.h"
+
+void Tracer::visit(const Value& value) {
+  switch (value.type()) {
+    case ValueType::FUNCTION: visit(value.asFunction().get()); break;
+    case ValueType::CLASS: visit(value.asClass().get()); break;
+    case ValueType::INSTANCE: visit(value.asInstance().get()); break;
+    default: break;
+  }
+}
@@ -0,0 +1,210 @@
+#pragma once
+
+#include <algorithm>    // std::max
+#include <cstddef>      // std::size_t
+#include <memory>
+#include <utility>      // std::move
+#include <vector>
+
+class Traced;
+class Value;
+
+// Handed to Traced::trace(), which passes it every traced object the
+// traced object refers to.
+class Tracer {
+public:
+  virtual void visit(Traced* object) = 0;
+
+  // Only functions, classes and instances are traced.
+  void visit(const Value& value);
+
+protected:
+  ~Tracer() = default;
+};
+
+// Environments, functions, classes and instances are owned through
+// shared_ptr, and they can refer to each other in cycles: a function
+// keeps its closure alive, while the closure holds the function in a
+// slot. Reference counting alone would never free such a cycle, so
+// each of these objects is also known to the Heap, which finds the
+// ones that are no longer in use and breaks their references.
+class Traced: public std::enable_shared_from_this<Traced> {
+  friend class Heap;
+
+  // Every traced object is on the Heap's list.
+  Traced* previous = nullptr;
+  Traced* next = nullptr;
+
+  // Only meaningful during a collection.
+  long references = 0;
+  bool reachable = false;
+
+public:
+  Traced();
+
+  // A copy is an object of its own.
+  Traced(const Traced&);
+  Traced& operator=(const Traced&) = delete;
+
+  virtual ~Traced();
+
+  // Passes the tracer each traced object this one holds a shared_ptr
+  // to, once for every such shared_ptr.
+  virtual void trace(Tracer& tracer) = 0;
+
+  // Drops every reference the object holds, once the collector has
+  // found that nothing can reach it anymore.
+  virtual void clear() = 0;
+};
+
+// A mark-sweep collector for traced objects, which leaves freeing
+// memory to the shared_ptrs. The roots are whatever the rest of the
+// program refers to: globals, the environments in use, values in
+// C++ locals and on the VM's stack. Rather than listing them, the
+// collector finds them by their reference counts. An object with
+// more references than other traced objects account for must be
+// referred to from outside the heap.
+//
+// Everything reachable from the roots is marked. The references of
+// the rest are cleared, which breaks the cycles among them, and their
+// reference counts then free them.
+class Heap {
+  Traced* objects = nullptr;
+  std::size_t count = 0;
+
+  std::size_t threshold = 64 * 1024;
+  double growth = 2;
+  std::size_t nextCollection = threshold;
+
+public:
+  // How many objects there may be before the first collection, and
+  // how much the heap may grow after each one, as a multiple of the
+  // objects that were still in use.
+  void configure(std::size_t threshold, double growth) {
+    this->threshold = threshold;
+    this->growth = growth;
+    nextCollection = threshold;
+  }
+
+  void add(Traced* object) {
+    object->next = objects;
+    if (objects != nullptr) objects->previous = object;
+    objects = object;
+    ++count;
+  }
+
+  void remove(Traced* object) {
+    if (object->previous != nullptr) {
+      object->previous->next = object->next;
+    } else {
+      objects = object->next;
+    }
+
+    if (object->next != nullptr) {
+      object->next->previous = object->previous;
+    }
+
+    --count;
+  }
+
+  // A collection may only happen where every object in use is held
+  // by a shared_ptr, since the objects the collector frees are found
+  // from their reference counts. The engines call this at the start
+  // of every call and every iteration of a loop, which is where any
+  // program that keeps allocating must pass through.
+  void collectIfNeeded() {
+    if (count >= nextCollection) collect();
+  }
+
+  void collect();
+
+  // Breaks every reference between traced objects, whether they are
+  // in use or not, once the program is done with them. Freeing a long
+  // chain of objects, like a linked list of instances, would otherwise
+  // nest a destructor for each of them and could run out of stack.
+  void releaseAll();
+};
+
+inline Heap heap;
+
+inline Traced::Traced() {
+  heap.add(this);
+}
+
+inline Traced::Traced(const Traced&)
+  : Traced{}
+{}
+
+inline Traced::~Traced() {
+  heap.remove(this);
+}
+
+inline void Heap::collect() {
+  // Subtracting the references traced objects hold from each object's
+  // reference count leaves the references from outside the heap.
+  struct : Tracer {
+    void visit(Traced* object) override {
+      --object->references;
+    }
+  } subtract;
+
+  for (Traced* object = objects; object; object = object->next) {
+    // Nothing can refer to an object that isn't owned by a shared_ptr
+    // yet, so it counts as referenced from outside.
+    object->references = object->weak_from_this().use_count();
+    if (object->references == 0) object->references = 1;
+    object->reachable = false;
+  }
+
+  for (Traced* object = objects; object; object = object->next) {
+    object->trace(subtract);
+  }
+
+  // Marks everything reachable from the roots, without recursing.
+  struct Mark: Tracer {
+    std::vector<Traced*> pending;
+
+    void visit(Traced* object) override {
+      if (object->reachable) return;
+      object->reachable = true;
+      pending.push_back(object);
+    }
+  } mark;
+
+  for (Traced* object = objects; object; object = object->next) {
+    if (object->references > 0) mark.visit(object);
+  }
+
+  while (!mark.pending.empty()) {
+    Traced* object = mark.pending.back();
+    mark.pending.pop_back();
+    object->trace(mark);
+  }
+
+  // The garbage is kept alive until all of it has been cleared, so no
+  // object is freed while others still refer to it.
+  std::vector<std::shared_ptr<Traced>> garbage;
+  for (Traced* object = objects; object; object = object->next) {
+    if (!object->reachable) {
+      garbage.push_back(object->shared_from_this());
+    }
+  }
+
+  for (const std::shared_ptr<Traced>& object : garbage) object->clear();
+  garbage.clear();
+
+  nextCollection = std::max(threshold,
+                            static_cast<std::size_t>(count * growth));
+}
+
+inline void Heap::releaseAll() {
+  // Nothing is freed until every object has been cleared. An object
+  // that isn't owned by a shared_ptr has nothing to free it anyway.
+  std::vector<std::shared_ptr<Traced>> all;
+  for (Traced* object = objects; object; object = object->next) {
+    std::shared_ptr<Traced> owner = object->weak_from_this().lock();
+    if (owner != nullptr) all.push_back(std::move(owner));
+  }
+
+  for (const std::shared_ptr<Traced>& object : all) object->clear();
+}
@@ -1,31 +1,36 @@
 #pragma once
 
-#include <any>
 #include <chrono>
+#include <cstddef>        // std::size_t
 #include <iostream>
+#include <iterator>       // std::make_move_iterator
 #include <map>
 #include <memory>
 #include <stdexcept>
 #include <string>
 #include <vector>
 #include <utility>        // std::move
+#include "Completion.h"
 #include "Environment.h"
 #include "Error.h"
 #include "Expr.h"
+#include "Globals.h"
+#include "Heap.h"
 #include "LoxCallable.h"
 #include "LoxClass.h"
 #include "LoxFunction.h"
 #include "LoxInstance.h"
-#include "LoxReturn.h"
+#include "Number.h"
 #include "RuntimeError.h"
 #include "Stmt.h"
+#include "Value.h"
 
 class NativeClock: public LoxCallable {
 public:
   int arity() override { return 0; }
 
-  std::any call(Interpreter& interpreter,
-                std::vector<std::any> arguments) override {
+  Value call(Interpreter& interpreter,
+             Arguments arguments) override {
     auto ticks = std::chrono::system_clock::now().time_since_epoch();
     return std::chrono::duration<double>{ticks}.count() / 1000.0;
   }
@@ -33,24 +38,141 @@ public:
   std::string toString() override { return "<native fn>"; }
 };
 
-class Interpreter: public ExprVisitor,
-                   public StmtVisitor {
+class Jit;
+
+class Interpreter: public ExprVisitor<Value>,
+                   public StmtVisitor<Completion> {
+friend class ClosureCompiler;
 friend class LoxFunction;
+friend class VM;
+
+public:
+  Globals globals;
+
+  // Compiles hot functions to native code, if enabled.
+  Jit* jit = nullptr;
+
+  // How many calls may be running at once. One more is a stack
+  // overflow, which is reported as a runtime error rather than left
+  // to crash the process.
+  int maxCallDepth = 100000;
 
-public:  std::shared_ptr<Environment> globals{new Environment};
 private:
-  std::shared_ptr<Environment> environment = globals;
-  std::map<std::shared_ptr<Expr>, int> locals;
+  // The global scope has no environment of its own, since globals
+  // are kept in their own table. At the top level environment is
+  // null.
+  std::shared_ptr<Environment> environment = nullptr;
+
+  // The value of the return statement being executed.
+  Value returnValue;
+
+  // A call in tail position is not made where it appears. The return
+  // statement leaves it here instead, for LoxFunction::invoke() to
+  // make once the function making it has returned.
+  struct TailCall {
+    std::shared_ptr<LoxFunction> function;
+
+    // Null if the function brings its own, as a bound method does.
+    std::shared_ptr<LoxInstance> receiver;
+
+    std::vector<Value> arguments;
+  };
+
+  TailCall tailCall;
+
+  // Arguments are evaluated onto the end of this stack, which keeps
+  // its memory from one call to the next, so passing them allocates
+  // nothing. An ArgumentFrame holds the arguments of one call, and
+  // takes them off the stack again when the call is over.
+  std::vector<Value> argumentStack;
+
+  class ArgumentFrame {
+    Interpreter& interpreter;
+    std::size_t base;
+
+  public:
+    ArgumentFrame(Interpreter& interpreter)
+      : interpreter{interpreter},
+        base{interpreter.argumentStack.size()}
+    {}
+
+    ArgumentFrame(const ArgumentFrame&) = delete;
+    ArgumentFrame& operator=(const ArgumentFrame&) = delete;
+
+    ~ArgumentFrame() {
+      std::vector<Value>& stack = interpreter.argumentStack;
+      stack.erase(stack.begin() + base, stack.end());
+    }
+
+    void push(Value value) {
+      interpreter.argumentStack.push_back(std::move(value));
+    }
+
+    // Only valid until the next push, which may move the stack.
+    Arguments arguments() {
+      std::vector<Value>& stack = interpreter.argumentStack;
+      return Arguments{stack.data() + base, stack.size() - base};
+    }
+  };
+
+  // Puts back the environment a block replaced when the block is
+  // left, whether it finished, returned or failed.
+  class EnvironmentGuard {
+    Interpreter& interpreter;
+    std::shared_ptr<Environment> previous;
+
+  public:
+    EnvironmentGuard(Interpreter& interpreter,
+                     std::shared_ptr<Environment> environment)
+      : interpreter{interpreter},
+        previous{std::move(interpreter.environment)}
+    {
+      interpreter.environment = std::move(environment);
+    }
+
+    EnvironmentGuard(const EnvironmentGuard&) = delete;
+    EnvironmentGuard& operator=(const EnvironmentGuard&) = delete;
+
+    ~EnvironmentGuard() {
+      interpreter.environment = std::move(previous);
+    }
+  };
+
+  // The number of calls running, which a CallGuard counts for as long
+  // as its call runs. Calls in tail position aren't counted, since
+  // they replace the call that made them.
+  int callDepth = 0;
+
+  class CallGuard {
+    Interpreter& interpreter;
+
+  public:
+    CallGuard(Interpreter& interpreter, const Token& paren)
+      : interpreter{interpreter}
+    {
+      if (interpreter.callDepth >= interpreter.maxCallDepth) {
+        throw RuntimeError{paren, "Stack overflow."};
+      }
+
+      ++interpreter.callDepth;
+    }
+
+    CallGuard(const CallGuard&) = delete;
+    CallGuard& operator=(const CallGuard&) = delete;
+
+    ~CallGuard() {
+      --interpreter.callDepth;
+    }
+  };
 
 public:
   Interpreter() {
-    globals->define("clock", std::shared_ptr<NativeClock>{});
+    globals.define("clock", Value{std::make_shared<NativeClock>()});
   }
 
-  void interpret(const std::vector<
-      std::shared_ptr<Stmt>>& statements) {
+  void interpret(const std::vector<Stmt*>& statements) {
     try {
-      for (const std::shared_ptr<Stmt>& statement : statements) {
+      for (Stmt* statement : statements) {
         execute(statement);
       }
     } catch (RuntimeError error) {
@@ -59,423 +181,592 @@ public:
   }
 
 private:
-  std::any evaluate(std::shared_ptr<Expr> expr) {
+  Value evaluate(Expr* expr) {
     return expr->accept(*this);
   }
 
-  void execute(std::shared_ptr<Stmt> stmt) {
-    stmt->accept(*this);
-  }
-
-public:
-  void resolve(std::shared_ptr<Expr> expr, int depth) {
-    locals[expr] = depth;
+  Completion execute(Stmt* stmt) {
+    return stmt->accept(*this);
   }
 
-private:
-  void executeBlock(
-      const std::vector<std::shared_ptr<Stmt>>& statements,
+  Completion executeBlock(
+      const std::vector<Stmt*>& statements,
       std::shared_ptr<Environment> environment) {
-    std::shared_ptr<Environment> previous = this->environment;
-    try {
-      this->environment = environment;
+    EnvironmentGuard guard{*this, std::move(environment)};
 
-      for (const std::shared_ptr<Stmt>& statement : statements) {
-        execute(statement);
+    for (Stmt* statement : statements) {
+      if (execute(statement) == Completion::RETURN) {
+        return Completion::RETURN;
       }
-    } catch (...) {
-      this->environment = previous;
-      throw;
     }
 
-    this->environment = previous;
+    return Completion::NORMAL;
   }
 
 public:
-  std::any visitBlockStmt(std::shared_ptr<Block> stmt) override {
-    executeBlock(stmt->statements,
-                 std::make_shared<Environment>(environment));
-    return {};
+  Completion visitBlockStmt(Block* stmt) override {
+    return executeBlock(stmt->statements,
+                        std::make_shared<Environment>(environment));
   }
 
-  std::any visitClassStmt(std::shared_ptr<Class> stmt) override {
-    std::any superclass;
+  Completion visitClassStmt(Class* stmt) override {
+    Value superclass;
     if (stmt->superclass != nullptr) {
       superclass = evaluate(stmt->superclass);
-      if (superclass.type() != typeid(std::shared_ptr<LoxClass>)) {
+      if (!superclass.isClass()) {
         throw RuntimeError(stmt->superclass->name,
             "Superclass must be a class.");
       }
     }
 
-    environment->define(stmt->name.lexeme, nullptr);
-
     if (stmt->superclass != nullptr) {
       environment = std::make_shared<Environment>(environment);
-      environment->define("super", superclass);
+      environment->define(superclass);
     }
 
     std::map<std::string, std::shared_ptr<LoxFunction>> methods;
-    for (std::shared_ptr<Function> method : stmt->methods) {
+    for (Function* method : stmt->methods) {
       auto function = std::make_shared<LoxFunction>(method,
           environment, method->name.lexeme == "init");
-      methods[method->name.lexeme] = function;
+      methods[std::string{method->name.lexeme}] = function;
     }
 
     std::shared_ptr<LoxClass> superklass = nullptr;
-    if (superclass.type() == typeid(std::shared_ptr<LoxClass>)) {
-      superklass = std::any_cast<
-          std::shared_ptr<LoxClass>>(superclass);
+    if (superclass.isClass()) {
+      superklass = superclass.asClass();
     }
-    auto klass = std::make_shared<LoxClass>(stmt->name.lexeme,
-        superklass, methods);
+    auto klass = std::make_shared<LoxClass>(
+        std::string{stmt->name.lexeme}, superklass, methods);
 
     if (superklass != nullptr) {
       environment = environment->enclosing;
     }
 
-    environment->assign(stmt->name, std::move(klass));
-    return {};
+    // The class's name only gets bound once the class is complete.
+    // In jlox it is defined up front and assigned afterwards, but
+    // nothing can observe the name in between, and defining it once
+    // keeps the slot order the same as the Resolver's.
+    define(stmt->name, std::move(klass));
+    return Completion::NORMAL;
   }
 
-  std::any visitExpressionStmt(
-      std::shared_ptr<Expression> stmt) override {
+  Completion visitExpressionStmt(Expression* stmt) override {
     evaluate(stmt->expression);
-    return {};
+    return Completion::NORMAL;
   }
 
-  std::any visitFunctionStmt(
-      std::shared_ptr<Function> stmt) override {
+  Completion visitFunctionStmt(Function* stmt) override {
     auto function = std::make_shared<LoxFunction>(stmt, environment,
                                                   false);
-    environment->define(stmt->name.lexeme, function);
-    return {};
+    define(stmt->name, function);
+    return Completion::NORMAL;
   }
 
-  std::any visitIfStmt(std::shared_ptr<If> stmt) override {
+  Completion visitIfStmt(If* stmt) override {
     if (isTruthy(evaluate(stmt->condition))) {
-      execute(stmt->thenBranch);
+      return execute(stmt->thenBranch);
     } else if (stmt->elseBranch != nullptr) {
-      execute(stmt->elseBranch);
+      return execute(stmt->elseBranch);
     }
-    return {};
+
+    return Completion::NORMAL;
   }
 
-  std::any visitPrintStmt(std::shared_ptr<Print> stmt) override {
-    std::any value = evaluate(stmt->expression);
-    std::cout << stringify(value) << "\n";
-    return {};
+  Completion visitPrintStmt(Print* stmt) override {
+    print(evaluate(stmt->expression));
+    return Completion::NORMAL;
   }
 
-  std::any visitReturnStmt(std::shared_ptr<Return> stmt) override {
-    std::any value = nullptr;
-    if (stmt->value != nullptr) value = evaluate(stmt->value);
+  Completion visitReturnStmt(Return* stmt) override {
+    returnValue = nullptr;
+    if (stmt->value != nullptr) returnValue = evaluate(stmt->value);
 
-    throw LoxReturn{value};
+    return Completion::RETURN;
   }
 
-  std::any visitVarStmt(std::shared_ptr<Var> stmt) override {
-    std::any value = nullptr;
+  Completion visitVarStmt(Var* stmt) override {
+    Value value = nullptr;
     if (stmt->initializer != nullptr) {
       value = evaluate(stmt->initializer);
     }
 
-    environment->define(stmt->name.lexeme, std::move(value));
-    return {};
+    define(stmt->name, std::move(value));
+    return Completion::NORMAL;
   }
 
-  std::any visitWhileStmt(std::shared_ptr<While> stmt) override {
+  Completion visitWhileStmt(While* stmt) override {
     while (isTruthy(evaluate(stmt->condition))) {
-      execute(stmt->body);
+      heap.collectIfNeeded();
+      if (execute(stmt->body) == Completion::RETURN) {
+        return Completion::RETURN;
+      }
     }
-    return {};
+
+    return Completion::NORMAL;
   }
 
-  std::any visitAssignExpr(std::shared_ptr<Assign> expr) override {
-    std::any value = evaluate(expr->value);
+  Value visitAssignExpr(Assign* expr) override {
+    Value value = evaluate(expr->value);
 
-    auto elem = locals.find(expr);
-    if (elem != locals.end()) {
-      int distance = elem->second;
-      environment->assignAt(distance, expr->name, value);
+    if (expr->depth >= 0) {
+      environment->assignAt(expr->depth, expr->slot, value);
     } else {
-      globals->assign(expr->name, value);
+      globals.assign(globalSlot(expr->name, expr->slot), expr->name,
+                     value);
     }
 
     return value;
   }
 
-  std::any visitBinaryExpr(std::shared_ptr<Binary> expr) override {
-    std::any left = evaluate(expr->left);
-    std::any right = evaluate(expr->right);
+  Value visitBinaryExpr(Binary* expr) override {
+    Value left = evaluate(expr->left);
+    Value right = evaluate(expr->right);
 
-    switch (expr->op.type) {
-      case BANG_EQUAL: return !isEqual(left, right);
-      case EQUAL_EQUAL: return isEqual(left, right);
-      case GREATER:
-        checkNumberOperands(expr->op, left, right);
-        return std::any_cast<double>(left) >
-               std::any_cast<double>(right);
-      case GREATER_EQUAL:
-        checkNumberOperands(expr->op, left, right);
-        return std::any_cast<double>(left) >=
-               std::any_cast<double>(right);
-      case LESS:
-        checkNumberOperands(expr->op, left, right);
-        return std::any_cast<double>(left) <
-               std::any_cast<double>(right);
-      case LESS_EQUAL:
-        checkNumberOperands(expr->op, left, right);
-        return std::any_cast<double>(left) <=
-               std::any_cast<double>(right);
-      case MINUS:
-        checkNumberOperands(expr->op, left, right);
-        return std::any_cast<double>(left) -
-               std::any_cast<double>(right);
-      case PLUS:
-        if (left.type() == typeid(double) &&
-            right.type() == typeid(double)) {
-          return std::any_cast<double>(left) +
-                 std::any_cast<double>(right);
+    switch (expr->specialized) {
+      case Specialization::UNINITIALIZED:
+        expr->specialized = specialize(expr->op, left, right);
+        return binary(expr->op, left, right);
+      case Specialization::NUMBER:
+        if (left.isNumber() && right.isNumber()) {
+          return binary(expr->op.type, left.asNumber(),
+                        right.asNumber());
         }
-
-        if (left.type() == typeid(std::string) &&
-            right.type() == typeid(std::string)) {
-          return std::any_cast<std::string>(left) +
-                 std::any_cast<std::string>(right);
+        break;
+      case Specialization::STRING:
+        if (left.isString() && right.isString()) {
+          return binary(expr->op.type, left.asString(),
+                        right.asString());
         }
-
-        throw RuntimeError{expr->op,
-            "Operands must be two numbers or two strings."};
-      case SLASH:
-        checkNumberOperands(expr->op, left, right);
-        return std::any_cast<double>(left) /
-               std::any_cast<double>(right);
-      case STAR:
-        checkNumberOperands(expr->op, left, right);
-        return std::any_cast<double>(left) *
-               std::any_cast<double>(right);
+        break;
+      default:
+        break;
     }
 
-    // Unreachable.
-    return {};
+    expr->specialized = Specialization::GENERIC;
+    return binary(expr->op, left, right);
   }
 
-  std::any visitCallExpr(std::shared_ptr<Call> expr) override {
-    std::any callee = evaluate(expr->callee);
+  Value visitCallExpr(Call* expr) override {
+    // A method that is called right away is never bound to its
+    // instance, which is passed straight to it instead.
+    std::shared_ptr<LoxInstance> receiver;
+    std::shared_ptr<LoxFunction> method;
+    Value callee;
 
-    std::vector<std::any> arguments;
-    for (const std::shared_ptr<Expr>& argument : expr->arguments) {
-      arguments.push_back(evaluate(argument));
-    }
+    switch (expr->callee->type) {
+      case ExprType::GET: {
+        auto get = static_cast<Get*>(expr->callee);
+        Value object = evaluate(get->object);
+        if (!object.isInstance()) {
+          throw RuntimeError(get->name,
+              "Only instances have properties.");
+        }
 
-    // Pointers in a std::any wrapper must be unwrapped before they
-    // can be cast.
-    std::shared_ptr<LoxCallable> function;
+        receiver = object.asInstance();
+        method = receiver->getMethod(get->name, get->cache);
+        if (method == nullptr) {
+          callee = receiver->get(get->name, get->cache);
+        }
+        break;
+      }
+      case ExprType::SUPER:
+        method = superMethod(static_cast<Super*>(expr->callee),
+                             receiver);
+        break;
+      default:
+        callee = evaluate(expr->callee);
+        break;
+    }
 
-    if (callee.type() == typeid(std::shared_ptr<LoxFunction>)) {
-      function = std::any_cast<std::shared_ptr<LoxFunction>>(callee);
-    } else if (callee.type() == typeid(std::shared_ptr<LoxClass>)) {
-      function = std::any_cast<std::shared_ptr<LoxClass>>(callee);
-    // } else if (callee.type() ==
-    //     typeid(std::shared_ptr<NativeClock>)) {
-    //   function = std::any_cast<std::shared_ptr<NativeClock>>(callee);
-    } else {
-      throw RuntimeError{expr->paren,
-          "Can only call functions and classes."};
+    ArgumentFrame frame{*this};
+    for (Expr* argument : expr->arguments) {
+      frame.push(evaluate(argument));
     }
 
-    if (arguments.size() != function->arity()) {
-      throw RuntimeError{expr->paren, "Expected " +
-          std::to_string(function->arity()) + " arguments but got " +
-          std::to_string(arguments.size()) + "."};
+    if (method != nullptr) {
+      return invoke(std::move(method), std::move(receiver),
+                    frame.arguments(), expr->paren, expr->tail);
     }
 
-    return function->call(*this, std::move(arguments));
+    return call(callee, frame.arguments(), expr->paren, expr->tail);
   }
 
-  std::any visitGetExpr(std::shared_ptr<Get> expr) override {
-    std::any object = evaluate(expr->object);
-    if (object.type() == typeid(std::shared_ptr<LoxInstance>)) {
-      return std::any_cast<
-          std::shared_ptr<LoxInstance>>(object)->get(expr->name);
+  Value visitGetExpr(Get* expr) override {
+    Value object = evaluate(expr->object);
+    if (object.isInstance()) {
+      return object.asInstance()->get(expr->name, expr->cache);
     }
 
     throw RuntimeError(expr->name,
         "Only instances have properties.");
   }
 
-  std::any visitGroupingExpr(
-      std::shared_ptr<Grouping> expr) override {
+  Value visitGroupingExpr(Grouping* expr) override {
     return evaluate(expr->expression);
   }
 
-  std::any visitLiteralExpr(std::shared_ptr<Literal> expr) override {
+  Value visitLiteralExpr(Literal* expr) override {
     return expr->value;
   }
 
-  std::any visitLogicalExpr(std::shared_ptr<Logical> expr) override {
-    std::any left = evaluate(expr->left);
+  Value visitLogicalExpr(Logical* expr) override {
+    Value left = evaluate(expr->left);
+
+    bool truthy;
+    switch (expr->specialized) {
+      case Specialization::UNINITIALIZED:
+        expr->specialized = left.isBool() ? Specialization::BOOL
+                                          : Specialization::GENERIC;
+        truthy = isTruthy(left);
+        break;
+      case Specialization::BOOL:
+        if (left.isBool()) {
+          truthy = left.asBool();
+          break;
+        }
+
+        expr->specialized = Specialization::GENERIC;
+        [[fallthrough]];
+      default:
+        truthy = isTruthy(left);
+        break;
+    }
 
     if (expr->op.type == OR) {
-      if (isTruthy(left)) return left;
+      if (truthy) return left;
     } else {
-      if (!isTruthy(left)) return left;
+      if (!truthy) return left;
     }
 
     return evaluate(expr->right);
   }
 
-  std::any visitSetExpr(std::shared_ptr<Set> expr) override {
-    std::any object = evaluate(expr->object);
+  Value visitSetExpr(Set* expr) override {
+    Value object = evaluate(expr->object);
 
-    if (object.type() != typeid(std::shared_ptr<LoxInstance>)) {
+    if (!object.isInstance()) {
       throw RuntimeError(expr->name,
                          "Only instances have fields.");
     }
 
-    std::any value = evaluate(expr->value);
-    std::any_cast<
-        std::shared_ptr<LoxInstance>>(object)->set(expr->name, value);
+    Value value = evaluate(expr->value);
+    object.asInstance()->set(expr->name, value, expr->cache);
     return value;
   }
 
-  std::any visitSuperExpr(std::shared_ptr<Super> expr) override {
-    int distance = locals[expr];
-    auto superclass = std::any_cast<
-        std::shared_ptr<LoxClass>>(environment->getAt(
-            distance, "super"));
+  Value visitSuperExpr(Super* expr) override {
+    std::shared_ptr<LoxInstance> object;
+    std::shared_ptr<LoxFunction> method = superMethod(expr, object);
+    return method->bind(std::move(object));
+  }
 
-    auto object = std::any_cast<std::shared_ptr<LoxInstance>>(
-        environment->getAt(distance - 1, "this"));
+  Value visitThisExpr(This* expr) override {
+    return lookUpVariable(expr->keyword, expr->depth, expr->slot);
+  }
 
-    std::shared_ptr<LoxFunction> method = superclass->findMethod(
-        expr->method.lexeme);
+  Value visitUnaryExpr(Unary* expr) override {
+    Value right = evaluate(expr->right);
 
-    if (method == nullptr) {
-      throw RuntimeError(expr->method,
-          "Undefined property '" + expr->method.lexeme + "'.");
+    switch (expr->specialized) {
+      case Specialization::UNINITIALIZED:
+        expr->specialized = specialize(expr->op, right);
+        return unary(expr->op, right);
+      case Specialization::NUMBER:
+        if (right.isNumber()) return -right.asNumber();
+        break;
+      case Specialization::BOOL:
+        if (right.isBool()) return !right.asBool();
+        break;
+      default:
+        break;
     }
 
-    return method->bind(object);
+    expr->specialized = Specialization::GENERIC;
+    return unary(expr->op, right);
   }
 
-  std::any visitThisExpr(std::shared_ptr<This> expr) override {
-    return lookUpVariable(expr->keyword, expr);
+  Value visitVariableExpr(Variable* expr) override {
+    return lookUpVariable(expr->name, expr->depth, expr->slot);
   }
 
-  std::any visitUnaryExpr(std::shared_ptr<Unary> expr) override {
-    std::any right = evaluate(expr->right);
+private:
+  // The generic forms of the operators, which check their operands.
+  Value binary(const Token& op, const Value& left, const Value& right) {
+    switch (op.type) {
+      case BANG_EQUAL: return !isEqual(left, right);
+      case EQUAL_EQUAL: return isEqual(left, right);
+      case GREATER:
+        checkNumberOperands(op, left, right);
+        return left.asNumber() > right.asNumber();
+      case GREATER_EQUAL:
+        checkNumberOperands(op, left, right);
+        return left.asNumber() >= right.asNumber();
+      case LESS:
+        checkNumberOperands(op, left, right);
+        return left.asNumber() < right.asNumber();
+      case LESS_EQUAL:
+        checkNumberOperands(op, left, right);
+        return left.asNumber() <= right.asNumber();
+      case MINUS:
+        checkNumberOperands(op, left, right);
+        return left.asNumber() - right.asNumber();
+      case PLUS:
+        if (left.isNumber() && right.isNumber()) {
+          return left.asNumber() + right.asNumber();
+        }
 
-    switch (expr->op.type) {
+        if (left.isString() && right.isString()) {
+          return left.asString() + right.asString();
+        }
+
+        throw RuntimeError{op,
+            "Operands must be two numbers or two strings."};
+      case SLASH:
+        checkNumberOperands(op, left, right);
+        return left.asNumber() / right.asNumber();
+      case STAR:
+        checkNumberOperands(op, left, right);
+        return left.asNumber() * right.asNumber();
+    }
+
+    // Unreachable.
+    return {};
+  }
+
+  Value unary(const Token& op, const Value& right) {
+    switch (op.type) {
       case BANG:
         return !isTruthy(right);
       case MINUS:
-        checkNumberOperand(expr->op, right);
-        return -std::any_cast<double>(right);
+        checkNumberOperand(op, right);
+        return -right.asNumber();
     }
 
     // Unreachable.
     return {};
   }
 
-  std::any visitVariableExpr(
-      std::shared_ptr<Variable> expr) override {
-    return lookUpVariable(expr->name, expr);
+  // The specialized forms, whose operands are known to be the right
+  // types.
+  static Value binary(TokenType op, double left, double right) {
+    switch (op) {
+      case BANG_EQUAL: return left != right;
+      case EQUAL_EQUAL: return left == right;
+      case GREATER: return left > right;
+      case GREATER_EQUAL: return left >= right;
+      case LESS: return left < right;
+      case LESS_EQUAL: return left <= right;
+      case MINUS: return left - right;
+      case PLUS: return left + right;
+      case SLASH: return left / right;
+      case STAR: return left * right;
+    }
+
+    // Unreachable.
+    return {};
   }
 
-private:
-  std::any lookUpVariable(const Token& name,
-                          std::shared_ptr<Expr> expr) {
-    auto elem = locals.find(expr);
-    if (elem != locals.end()) {
-      int distance = elem->second;
-      return environment->getAt(distance, name.lexeme);
-    } else {
-      return globals->get(name);
+  static Value binary(TokenType op, const std::string& left,
+                      const std::string& right) {
+    switch (op) {
+      case BANG_EQUAL: return left != right;
+      case EQUAL_EQUAL: return left == right;
+      case PLUS: return left + right;
     }
-  }
 
-  void checkNumberOperand(const Token& op,
-                          const std::any& operand) {
-    if (operand.type() == typeid(double)) return;
-    throw RuntimeError{op, "Operand must be a number."};
+    // Unreachable.
+    return {};
   }
 
-  void checkNumberOperands(const Token& op,
-                           const std::any& left,
-                           const std::any& right) {
-    if (left.type() == typeid(double) &&
-        right.type() == typeid(double)) {
-      return;
+  // Picks the form a binary operator takes the first time it runs.
+  static Specialization specialize(const Token& op, const Value& left,
+                                   const Value& right) {
+    if (left.isNumber() && right.isNumber()) {
+      return Specialization::NUMBER;
     }
 
-    throw RuntimeError{op, "Operands must be numbers."};
+    bool stringOp = op.type == PLUS || op.type == EQUAL_EQUAL ||
+                    op.type == BANG_EQUAL;
+    if (stringOp && left.isString() && right.isString()) {
+      return Specialization::STRING;
+    }
+
+    return Specialization::GENERIC;
   }
 
-  bool isTruthy(const std::any& object) {
-    if (object.type() == typeid(nullptr)) return false;
-    if (object.type() == typeid(bool)) {
-      return std::any_cast<bool>(object);
+  static Specialization specialize(const Token& op,
+                                   const Value& right) {
+    if (op.type == BANG && right.isBool()) return Specialization::BOOL;
+    if (op.type == MINUS && right.isNumber()) {
+      return Specialization::NUMBER;
     }
-    return true;
+
+    return Specialization::GENERIC;
   }
 
-  bool isEqual(const std::any& a, const std::any& b) {
-    if (a.type() == typeid(nullptr) && b.type() == typeid(nullptr)) {
-      return true;
+  // Finds the method "super" refers to, along with the instance it
+  // should be called on.
+  std::shared_ptr<LoxFunction> superMethod(
+      Super* expr, std::shared_ptr<LoxInstance>& object) {
+    // "super" is alone in its scope, which is the closure of the
+    // method. The method's own environment, just inside it, holds
+    // "this" in its first slot.
+    int distance = expr->depth;
+    std::shared_ptr<LoxClass> superclass =
+        environment->getAt(distance, 0).asClass();
+
+    object = environment->getAt(distance - 1, 0).asInstance();
+
+    std::shared_ptr<LoxFunction> method = superclass->findMethod(
+        expr->method.lexeme);
+
+    if (method == nullptr) {
+      throw RuntimeError(expr->method,
+          "Undefined property '" + std::string{expr->method.lexeme} +
+          "'.");
     }
-    if (a.type() == typeid(nullptr)) return false;
 
-    if (a.type() == typeid(std::string) &&
-        b.type() == typeid(std::string)) {
-      return std::any_cast<std::string>(a) ==
-             std::any_cast<std::string>(b);
+    return method;
+  }
+
+  Value invoke(std::shared_ptr<LoxFunction> method,
+               std::shared_ptr<LoxInstance> receiver,
+               Arguments arguments, const Token& paren, bool tail) {
+    checkArity(method->arity(), arguments.size(), paren);
+
+    // The pending call keeps its arguments in a vector of its own,
+    // which is reused by every tail call.
+    if (tail) {
+      tailCall.function = std::move(method);
+      tailCall.receiver = std::move(receiver);
+      tailCall.arguments.assign(
+          std::make_move_iterator(arguments.begin()),
+          std::make_move_iterator(arguments.end()));
+      return nullptr;
     }
-    if (a.type() == typeid(double) && b.type() == typeid(double)) {
-      return std::any_cast<double>(a) == std::any_cast<double>(b);
+
+    CallGuard guard{*this, paren};
+    return method->invoke(*this, receiver, arguments);
+  }
+
+  // Only calls to Lox functions are left for the caller to make in a
+  // tail position. Classes and native functions are called right away.
+  Value call(const Value& callee, Arguments arguments,
+             const Token& paren, bool tail) {
+    if (tail && callee.isFunction()) {
+      return invoke(callee.asFunction(), nullptr, arguments, paren,
+                    true);
     }
-    if (a.type() == typeid(bool) && b.type() == typeid(bool)) {
-      return std::any_cast<bool>(a) == std::any_cast<bool>(b);
+
+    // The callee keeps the object alive for the duration of the
+    // call, so a plain pointer is enough here.
+    LoxCallable* function;
+
+    switch (callee.type()) {
+      case ValueType::FUNCTION:
+        function = callee.asFunction().get();
+        break;
+      case ValueType::CLASS:
+        function = callee.asClass().get();
+        break;
+      case ValueType::NATIVE:
+        function = callee.asNative().get();
+        break;
+      default:
+        throw RuntimeError{paren,
+            "Can only call functions and classes."};
     }
 
-    return false;
-  }
+    checkArity(function->arity(), arguments.size(), paren);
 
-  std::string stringify(const std::any& object) {
-    if (object.type() == typeid(nullptr)) return "nil";
+    CallGuard guard{*this, paren};
+    return function->call(*this, arguments);
+  }
 
-    if (object.type() == typeid(double)) {
-      std::string text = std::to_string(
-          std::any_cast<double>(object));
-      if (text[text.length() - 2] == '.' &&
-          text[text.length() - 1] == '0') {
-        text = text.substr(0, text.length() - 2);
-      }
-      return text;
+  void checkArity(int arity, int argCount, const Token& paren) {
+    if (argCount != arity) {
+      throw RuntimeError{paren, "Expected " + std::to_string(arity) +
+          " arguments but got " + std::to_string(argCount) + "."};
     }
+  }
 
-    if (object.type() == typeid(std::string)) {
-      return std::any_cast<std::string>(object);
+  Value lookUpVariable(const Token& name, int depth, int& slot) {
+    if (depth >= 0) {
+      return environment->getAt(depth, slot);
+    } else {
+      return globals.get(globalSlot(name, slot), name);
     }
-    if (object.type() == typeid(bool)) {
-      return std::any_cast<bool>(object) ? "true" : "false";
+  }
+
+  // Unresolved names are globals. The first lookup through a node
+  // interns the name and caches its slot on the node.
+  int globalSlot(const Token& name, int& slot) {
+    if (slot < 0) slot = globals.intern(name.lexeme);
+    return slot;
+  }
+
+  // Declarations at the top level go into the globals table, and all
+  // others into the next slot of the current environment.
+  void define(const Token& name, Value value) {
+    if (environment == nullptr) {
+      globals.define(name.lexeme, std::move(value));
+    } else {
+      environment->define(std::move(value));
     }
-    if (object.type() == typeid(std::shared_ptr<LoxFunction>)) {
-      return std::any_cast<
-          std::shared_ptr<LoxFunction>>(object)->toString();
+  }
+
+  void checkNumberOperand(const Token& op, const Value& operand) {
+    if (operand.isNumber()) return;
+    throw RuntimeError{op, "Operand must be a number."};
+  }
+
+  void checkNumberOperands(const Token& op,
+                           const Value& left, const Value& right) {
+    if (left.isNumber() && right.isNumber()) return;
+
+    throw RuntimeError{op, "Operands must be numbers."};
+  }
+
+  bool isTruthy(const Value& object) {
+    switch (object.type()) {
+      case ValueType::NIL: return false;
+      case ValueType::BOOL: return object.asBool();
+      default: return true;
     }
-    // if (object.type() == typeid(std::shared_ptr<NativeClock>)) {
-    //   return std::any_cast<
-    //       std::shared_ptr<NativeClock>>(object)->toString();
-    // }
-    if (object.type() == typeid(std::shared_ptr<LoxClass>)) {
-      return std::any_cast<
-          std::shared_ptr<LoxClass>>(object)->toString();
+  }
+
+  bool isEqual(const Value& a, const Value& b) {
+    return a == b;
+  }
+
+  // Numbers and strings, which are most of what programs print, are
+  // written out without building a string first.
+  void print(const Value& value) {
+    if (value.isNumber()) {
+      char buffer[NUMBER_LENGTH];
+      std::cout << formatNumber(value.asNumber(), buffer) << "\n";
+    } else if (value.isString()) {
+      std::cout << value.asString() << "\n";
+    } else {
+      std::cout << stringify(value) << "\n";
     }
-    if (object.type() == typeid(std::shared_ptr<LoxInstance>)) {
-      return std::any_cast<
-          std::shared_ptr<LoxInstance>>(object)->toString();
+  }
+
+  std::string stringify(const Value& object) {
+    switch (object.type()) {
+      case ValueType::NIL: return "nil";
+
+      case ValueType::NUMBER: {
+        char buffer[NUMBER_LENGTH];
+        return std::string{formatNumber(object.asNumber(), buffer)};
+      }
+
+      case ValueType::STRING: return object.asString();
+      case ValueType::BOOL: return object.asBool() ? "true" : "false";
+      case ValueType::FUNCTION: return object.asFunction()->toString();
+      case ValueType::CLASS: return object.asClass()->toString();
+      case ValueType::INSTANCE: return object.asInstance()->toString();
+      case ValueType::NATIVE: return object.asNative()->toString();
     }
 
     return "Error in stringify: object type not recognized.";
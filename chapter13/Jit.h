@@ -0,0 +1,731 @@
+#pragma once
+
+#include <cstddef>        // offsetof, std::size_t
+#include <cstdint>        // std::int32_t, std::uint8_t, std::uint64_t
+#include <cstring>        // std::memcpy
+#include <optional>
+#include <unordered_map>
+#include <utility>        // std::move
+#include <vector>
+#include "Expr.h"
+#include "Globals.h"
+#include "LoxFunction.h"
+#include "Stmt.h"
+#include "Value.h"
+
+// Native code can only be generated for x86-64, and executable memory
+// is only requested from POSIX systems. Everywhere else the JIT
+// declines every function and the Interpreter runs them as usual.
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+#define JLOX_JIT_NATIVE
+#include <sys/mman.h>
+#endif
+
+class Jit;
+
+// Shared by all the native code running for one call from the
+// Interpreter. A helper that can't do what native code asked of it
+// sets bailed, and every frame of native code returns as soon as it
+// sees the flag.
+struct JitContext {
+  Jit* jit;
+  bool bailed;
+
+  // How many more calls may be nested before the stack overflows.
+  // Native code bails rather than go deeper, leaving the Interpreter
+  // to report the overflow.
+  int depth;
+};
+
+using NativeCode = double (*)(const double* arguments,
+                              JitContext* context);
+
+// Emits the handful of x86-64 instructions the JIT needs. Numbers
+// live in xmm0, with xmm1 as a scratch register, and intermediate
+// results are kept on the machine stack. rbx holds the JitContext and
+// r12 the arguments for the whole function.
+class Assembler {
+public:
+  std::vector<std::uint8_t> code;
+
+  int size() const { return code.size(); }
+
+  void bytes(std::initializer_list<std::uint8_t> bytes) {
+    code.insert(code.end(), bytes);
+  }
+
+  // Immediates are little-endian.
+  void int32(std::int32_t value) {
+    for (int i = 0; i < 4; ++i) {
+      code.push_back((value >> (8 * i)) & 0xff);
+    }
+  }
+
+  void int64(std::uint64_t value) {
+    for (int i = 0; i < 8; ++i) {
+      code.push_back((value >> (8 * i)) & 0xff);
+    }
+  }
+
+  void patch32(int offset, std::int32_t value) {
+    for (int i = 0; i < 4; ++i) {
+      code[offset + i] = (value >> (8 * i)) & 0xff;
+    }
+  }
+
+  // push rbp; mov rbp, rsp; push rbx; push r12; mov rbx, rsi;
+  // mov r12, rdi; sub rsp, <frame size>
+  // Returns the offset of the frame size, which is patched once the
+  // number of locals is known.
+  int prologue() {
+    bytes({0x55, 0x48, 0x89, 0xE5, 0x53, 0x41, 0x54,
+           0x48, 0x89, 0xF3, 0x49, 0x89, 0xFC,
+           0x48, 0x81, 0xEC});
+    int frameSize = size();
+    int32(0);
+    return frameSize;
+  }
+
+  // lea rsp, [rbp - 16]; pop r12; pop rbx; pop rbp; ret
+  void epilogue() {
+    bytes({0x48, 0x8D, 0x65, 0xF0, 0x41, 0x5C, 0x5B, 0x5D, 0xC3});
+  }
+
+  // The locals sit just below the two saved registers.
+  static std::int32_t localOffset(int index) {
+    return -24 - 8 * index;
+  }
+
+  // movsd xmm0, [rbp + offset]
+  void loadLocal(int index) {
+    bytes({0xF2, 0x0F, 0x10, 0x85});
+    int32(localOffset(index));
+  }
+
+  // movsd [rbp + offset], xmm0
+  void storeLocal(int index) {
+    bytes({0xF2, 0x0F, 0x11, 0x85});
+    int32(localOffset(index));
+  }
+
+  // movsd xmm0, [r12 + 8 * index]
+  void loadArgument(int index) {
+    bytes({0xF2, 0x41, 0x0F, 0x10, 0x84, 0x24});
+    int32(8 * index);
+  }
+
+  // mov rax, imm64; movq xmm0, rax
+  void loadConstant(double value) {
+    std::uint64_t bits;
+    std::memcpy(&bits, &value, sizeof bits);
+    bytes({0x48, 0xB8});
+    int64(bits);
+    bytes({0x66, 0x48, 0x0F, 0x6E, 0xC0});
+  }
+
+  // sub rsp, 8; movsd [rsp], xmm0
+  void push() {
+    bytes({0x48, 0x83, 0xEC, 0x08, 0xF2, 0x0F, 0x11, 0x04, 0x24});
+  }
+
+  // Moves the value in xmm0 to xmm1 and pops the value under it into
+  // xmm0, which leaves a binary operation's operands in order.
+  // movapd xmm1, xmm0; movsd xmm0, [rsp]; add rsp, 8
+  void popLeft() {
+    bytes({0x66, 0x0F, 0x28, 0xC8, 0xF2, 0x0F, 0x10, 0x04, 0x24,
+           0x48, 0x83, 0xC4, 0x08});
+  }
+
+  void add() { bytes({0xF2, 0x0F, 0x58, 0xC1}); }        // addsd
+  void subtract() { bytes({0xF2, 0x0F, 0x5C, 0xC1}); }   // subsd
+  void multiply() { bytes({0xF2, 0x0F, 0x59, 0xC1}); }   // mulsd
+  void divide() { bytes({0xF2, 0x0F, 0x5E, 0xC1}); }     // divsd
+
+  // Compares xmm0 with xmm1, or xmm1 with xmm0 if swapped, and turns
+  // the flags picked out by setcc into 0.0 or 1.0 in xmm0. "Above"
+  // conditions are false when either operand is NaN, as Lox requires.
+  void compare(std::uint8_t setcc, bool swapped) {
+    bytes({0x66, 0x0F, 0x2E, std::uint8_t(swapped ? 0xC8 : 0xC1)});
+    bytes({0x0F, setcc, 0xC0});
+    boolean();
+  }
+
+  void greater(bool swapped) { compare(0x97, swapped); }      // seta
+  void greaterEqual(bool swapped) { compare(0x93, swapped); } // setae
+
+  // ucomisd xmm0, xmm1; sete al; setnp cl; and al, cl
+  void equal() {
+    bytes({0x66, 0x0F, 0x2E, 0xC1, 0x0F, 0x94, 0xC0, 0x0F, 0x9B, 0xC1,
+           0x20, 0xC8});
+    boolean();
+  }
+
+  // ucomisd xmm0, xmm1; setne al; setp cl; or al, cl
+  void notEqual() {
+    bytes({0x66, 0x0F, 0x2E, 0xC1, 0x0F, 0x95, 0xC0, 0x0F, 0x9A, 0xC1,
+           0x08, 0xC8});
+    boolean();
+  }
+
+  // movzx eax, al; cvtsi2sd xmm0, eax
+  void boolean() {
+    bytes({0x0F, 0xB6, 0xC0, 0xF2, 0x0F, 0x2A, 0xC0});
+  }
+
+  // Flips the sign bit.
+  // mov rax, 0x8000000000000000; movq xmm1, rax; xorpd xmm0, xmm1
+  void negate() {
+    bytes({0x48, 0xB8});
+    int64(0x8000000000000000);
+    bytes({0x66, 0x48, 0x0F, 0x6E, 0xC8, 0x66, 0x0F, 0x57, 0xC1});
+  }
+
+  // Booleans are 0.0 or 1.0, so "not" is 1.0 - x.
+  void logicalNot() {
+    bytes({0x66, 0x0F, 0x28, 0xC8});    // movapd xmm1, xmm0
+    loadConstant(1.0);
+    subtract();
+  }
+
+  // Jumps if the Boolean in xmm0 is false.
+  // xorpd xmm1, xmm1; ucomisd xmm0, xmm1; je rel32
+  int jumpIfFalse() {
+    bytes({0x66, 0x0F, 0x57, 0xC9, 0x66, 0x0F, 0x2E, 0xC1, 0x0F, 0x84});
+    int offset = size();
+    int32(0);
+    return offset;
+  }
+
+  // xorpd xmm1, xmm1; ucomisd xmm0, xmm1; jne rel32
+  int jumpIfTrue() {
+    bytes({0x66, 0x0F, 0x57, 0xC9, 0x66, 0x0F, 0x2E, 0xC1, 0x0F, 0x85});
+    int offset = size();
+    int32(0);
+    return offset;
+  }
+
+  // jmp rel32
+  int jump() {
+    bytes({0xE9});
+    int offset = size();
+    int32(0);
+    return offset;
+  }
+
+  static constexpr std::uint8_t bailed = offsetof(JitContext, bailed);
+
+  // Jumps to the epilogue if a helper gave up.
+  // cmp byte [rbx + bailed], 0; jne rel32
+  int jumpIfBailed() {
+    bytes({0x80, 0x7B, bailed, 0x00, 0x0F, 0x85});
+    int offset = size();
+    int32(0);
+    return offset;
+  }
+
+  // mov byte [rbx + bailed], 1
+  void bail() {
+    bytes({0xC6, 0x43, bailed, 0x01});
+  }
+
+  void patchJump(int offset) {
+    patchJump(offset, size());
+  }
+
+  void patchJump(int offset, int target) {
+    patch32(offset, target - (offset + 4));
+  }
+
+  // sub rsp, imm32 / add rsp, imm32
+  void reserve(int bytes) {
+    this->bytes({0x48, 0x81, 0xEC});
+    int32(bytes);
+  }
+
+  void release(int bytes) {
+    this->bytes({0x48, 0x81, 0xC4});
+    int32(bytes);
+  }
+
+  // movsd [rsp + offset], xmm0
+  void storeOutgoing(int index) {
+    bytes({0xF2, 0x0F, 0x11, 0x84, 0x24});
+    int32(8 * index);
+  }
+
+  // Calls a helper with the context in rdi, a global slot in esi, and,
+  // for calls, the outgoing arguments at rsp in rdx and their count in
+  // ecx.
+  // mov rdi, rbx; mov esi, imm32; mov rdx, rsp; mov ecx, imm32;
+  // mov rax, imm64; call rax
+  void callHelper(const void* helper, int slot, int argCount) {
+    bytes({0x48, 0x89, 0xDF, 0xBE});
+    int32(slot);
+    bytes({0x48, 0x89, 0xE2, 0xB9});
+    int32(argCount);
+    bytes({0x48, 0xB8});
+    int64(reinterpret_cast<std::uint64_t>(helper));
+    bytes({0xFF, 0xD0});
+  }
+};
+
+// Compiles the body of a LoxFunction to native code, if it only uses
+// what the baseline JIT understands: numbers and Booleans, the
+// function's own locals, arithmetic and comparisons, if and while,
+// and calls to global functions with numeric arguments. Anything
+// else -- printing, strings, objects, closures over outer variables,
+// assigning to globals -- makes the compiler give up on the function.
+//
+// What is left can't have any effects outside of its own locals. If a
+// guard fails while the code is running, nothing observable has
+// happened yet, so the Interpreter can simply run the whole call
+// again from the start.
+class JitCompiler: public ExprVisitor<void>,
+                   public StmtVisitor<void> {
+  struct Unsupported {};
+
+  // Numbers are stored as they are, and Booleans as 0.0 or 1.0.
+  enum class Type { NUMBER, BOOLEAN };
+
+  Globals& globals;
+  Assembler assembler;
+
+  // The native local each variable of the Resolver's scopes maps to,
+  // for the scopes inside the function.
+  std::vector<std::vector<int>> scopes;
+  int localCount = 0;
+
+  // The type of the expression that was compiled last.
+  Type type = Type::NUMBER;
+
+  // Values on the machine stack, to keep calls aligned.
+  int pushed = 0;
+
+  std::vector<int> exits;
+
+  static double getGlobal(JitContext* context, int slot,
+                          const double*, int);
+  static double callGlobal(JitContext* context, int slot,
+                           const double* arguments, int argCount);
+
+public:
+  JitCompiler(Globals& globals)
+    : globals{globals}
+  {}
+
+  // Returns the machine code, or nothing if the function can't be
+  // compiled.
+  std::optional<std::vector<std::uint8_t>> compile(Function* function) {
+    try {
+      int frameSize = assembler.prologue();
+
+      scopes.emplace_back();
+      for (int i = 0; i < function->params.size(); ++i) {
+        int local = declare();
+        assembler.loadArgument(i);
+        assembler.storeLocal(local);
+      }
+
+      for (Stmt* statement : function->body) {
+        compile(statement);
+      }
+
+      // Falling off the end returns nil, which native code can't.
+      assembler.bail();
+
+      for (int exit : exits) assembler.patchJump(exit);
+      assembler.epilogue();
+
+      // Keep the stack 16-byte aligned.
+      assembler.patch32(frameSize, (localCount * 8 + 15) / 16 * 16);
+      return std::move(assembler.code);
+    } catch (Unsupported) {
+      return std::nullopt;
+    }
+  }
+
+private:
+  void compile(Stmt* stmt) {
+    stmt->accept(*this);
+  }
+
+  Type compile(Expr* expr) {
+    expr->accept(*this);
+    return type;
+  }
+
+  Type number(Expr* expr) {
+    if (compile(expr) != Type::NUMBER) throw Unsupported{};
+    return Type::NUMBER;
+  }
+
+  int declare() {
+    scopes.back().push_back(localCount);
+    return localCount++;
+  }
+
+  int local(int depth, int slot) {
+    // Globals, and variables captured from outside the function.
+    if (depth < 0 || depth >= scopes.size()) throw Unsupported{};
+    return scopes[scopes.size() - 1 - depth][slot];
+  }
+
+  // Numbers are always truthy in Lox, so only Boolean conditions
+  // can be false.
+  int condition(Expr* expr) {
+    if (compile(expr) == Type::BOOLEAN) return assembler.jumpIfFalse();
+    return -1;
+  }
+
+  void patch(int jump) {
+    if (jump >= 0) assembler.patchJump(jump);
+  }
+
+  void pushOperand() {
+    assembler.push();
+    ++pushed;
+  }
+
+  void popOperand() {
+    assembler.popLeft();
+    --pushed;
+  }
+
+  // Calls a helper, with padding to keep the stack aligned, and
+  // leaves the function if the helper gave up.
+  void callHelper(const void* helper, int slot,
+                  const std::vector<Expr*>& arguments) {
+    int argCount = arguments.size();
+    int padding = (pushed + argCount) % 2;
+    int reserved = argCount + padding;
+
+    if (reserved > 0) assembler.reserve(8 * reserved);
+    pushed += reserved;
+
+    for (int i = 0; i < argCount; ++i) {
+      number(arguments[i]);
+      assembler.storeOutgoing(i);
+    }
+
+    assembler.callHelper(helper, slot, argCount);
+
+    if (reserved > 0) assembler.release(8 * reserved);
+    pushed -= reserved;
+
+    exits.push_back(assembler.jumpIfBailed());
+  }
+
+public:
+  void visitBlockStmt(Block* stmt) override {
+    scopes.emplace_back();
+    for (Stmt* statement : stmt->statements) {
+      compile(statement);
+    }
+    scopes.pop_back();
+  }
+
+  void visitClassStmt(Class*) override { throw Unsupported{}; }
+
+  void visitExpressionStmt(Expression* stmt) override {
+    compile(stmt->expression);
+  }
+
+  void visitFunctionStmt(Function*) override { throw Unsupported{}; }
+
+  void visitIfStmt(If* stmt) override {
+    int thenJump = condition(stmt->condition);
+    compile(stmt->thenBranch);
+
+    if (stmt->elseBranch == nullptr) {
+      patch(thenJump);
+      return;
+    }
+
+    int elseJump = assembler.jump();
+    patch(thenJump);
+    compile(stmt->elseBranch);
+    assembler.patchJump(elseJump);
+  }
+
+  void visitPrintStmt(Print*) override { throw Unsupported{}; }
+
+  void visitReturnStmt(Return* stmt) override {
+    if (stmt->value == nullptr) throw Unsupported{};
+    number(stmt->value);
+    exits.push_back(assembler.jump());
+  }
+
+  void visitVarStmt(Var* stmt) override {
+    if (stmt->initializer == nullptr) throw Unsupported{};
+    number(stmt->initializer);
+    assembler.storeLocal(declare());
+  }
+
+  void visitWhileStmt(While* stmt) override {
+    int loopStart = assembler.size();
+    int exitJump = condition(stmt->condition);
+    compile(stmt->body);
+    assembler.patchJump(assembler.jump(), loopStart);
+    patch(exitJump);
+  }
+
+  void visitAssignExpr(Assign* expr) override {
+    int index = local(expr->depth, expr->slot);
+    number(expr->value);
+    assembler.storeLocal(index);
+    type = Type::NUMBER;
+  }
+
+  void visitBinaryExpr(Binary* expr) override {
+    Type left = compile(expr->left);
+    pushOperand();
+    Type right = compile(expr->right);
+    popOperand();
+
+    switch (expr->op.type) {
+      case BANG_EQUAL:
+      case EQUAL_EQUAL:
+        if (left != right) throw Unsupported{};
+        if (expr->op.type == EQUAL_EQUAL) {
+          assembler.equal();
+        } else {
+          assembler.notEqual();
+        }
+        type = Type::BOOLEAN;
+        return;
+      default:
+        break;
+    }
+
+    if (left != Type::NUMBER || right != Type::NUMBER) {
+      throw Unsupported{};
+    }
+
+    switch (expr->op.type) {
+      case GREATER: assembler.greater(false); break;
+      case GREATER_EQUAL: assembler.greaterEqual(false); break;
+      case LESS: assembler.greater(true); break;
+      case LESS_EQUAL: assembler.greaterEqual(true); break;
+      case MINUS: assembler.subtract(); break;
+      case PLUS: assembler.add(); break;
+      case SLASH: assembler.divide(); break;
+      case STAR: assembler.multiply(); break;
+      default: throw Unsupported{};
+    }
+
+    type = expr->op.type == GREATER || expr->op.type == GREATER_EQUAL ||
+           expr->op.type == LESS || expr->op.type == LESS_EQUAL
+        ? Type::BOOLEAN : Type::NUMBER;
+  }
+
+  // Native code calls recursively on the C++ stack, which tail calls
+  // must not grow, so those are left to the interpreter.
+  void visitCallExpr(Call* expr) override {
+    if (expr->tail) throw Unsupported{};
+    if (expr->callee->type != ExprType::VARIABLE) throw Unsupported{};
+    auto* callee = static_cast<Variable*>(expr->callee);
+    if (callee->depth >= 0) throw Unsupported{};
+
+    callHelper(reinterpret_cast<const void*>(&callGlobal),
+               globals.intern(callee->name.lexeme), expr->arguments);
+    type = Type::NUMBER;
+  }
+
+  void visitGetExpr(Get*) override { throw Unsupported{}; }
+
+  void visitGroupingExpr(Grouping* expr) override {
+    compile(expr->expression);
+  }
+
+  void visitLiteralExpr(Literal* expr) override {
+    switch (expr->value.type()) {
+      case ValueType::NUMBER:
+        assembler.loadConstant(expr->value.asNumber());
+        type = Type::NUMBER;
+        return;
+      case ValueType::BOOL:
+        assembler.loadConstant(expr->value.asBool() ? 1.0 : 0.0);
+        type = Type::BOOLEAN;
+        return;
+      default:
+        throw Unsupported{};
+    }
+  }
+
+  // Only Booleans, where "and" and "or" produce a Boolean too.
+  void visitLogicalExpr(Logical* expr) override {
+    if (compile(expr->left) != Type::BOOLEAN) throw Unsupported{};
+
+    int endJump = expr->op.type == OR ? assembler.jumpIfTrue()
+                                      : assembler.jumpIfFalse();
+    if (compile(expr->right) != Type::BOOLEAN) throw Unsupported{};
+    assembler.patchJump(endJump);
+
+    type = Type::BOOLEAN;
+  }
+
+  void visitSetExpr(Set*) override { throw Unsupported{}; }
+  void visitSuperExpr(Super*) override { throw Unsupported{}; }
+  void visitThisExpr(This*) override { throw Unsupported{}; }
+
+  void visitUnaryExpr(Unary* expr) override {
+    Type operand = compile(expr->right);
+
+    if (expr->op.type == MINUS && operand == Type::NUMBER) {
+      assembler.negate();
+    } else if (expr->op.type == BANG && operand == Type::BOOLEAN) {
+      assembler.logicalNot();
+    } else {
+      throw Unsupported{};
+    }
+  }
+
+  void visitVariableExpr(Variable* expr) override {
+    if (expr->depth < 0) {
+      callHelper(reinterpret_cast<const void*>(&getGlobal),
+                 globals.intern(expr->name.lexeme), {});
+    } else {
+      assembler.loadLocal(local(expr->depth, expr->slot));
+    }
+
+    type = Type::NUMBER;
+  }
+};
+
+// Counts calls to each function and compiles the hot ones. Native code
+// is shared by every LoxFunction with the same declaration, since it
+// doesn't depend on the function's closure.
+class Jit {
+  friend class JitCompiler;
+
+  struct Entry {
+    NativeCode code = nullptr;
+  };
+
+  Globals& globals;
+  std::unordered_map<Function*, Entry> entries;
+
+  // Executable memory, which is only unmapped with the JIT itself since
+  // native code may still be running after its function is abandoned.
+  std::vector<std::pair<void*, std::size_t>> regions;
+
+public:
+  // How many times a function must be called before it's compiled.
+  int threshold;
+
+  Jit(Globals& globals, int threshold)
+    : globals{globals}, threshold{threshold}
+  {}
+
+  Jit(const Jit&) = delete;
+  Jit& operator=(const Jit&) = delete;
+
+  ~Jit() {
+#ifdef JLOX_JIT_NATIVE
+    for (auto [memory, size] : regions) munmap(memory, size);
+#endif
+  }
+
+  // Runs a call natively, or returns nothing if the Interpreter has to
+  // run it instead. Depth is how many calls it may nest.
+  std::optional<Value> call(LoxFunction& function,
+                            Arguments arguments, int depth) {
+    Entry& entry = entryFor(function);
+    if (entry.code == nullptr) return std::nullopt;
+
+    // The Parser allows at most 255 arguments.
+    double numbers[255];
+    for (std::size_t i = 0; i < arguments.size(); ++i) {
+      if (!arguments[i].isNumber()) return std::nullopt;
+      numbers[i] = arguments[i].asNumber();
+    }
+
+    JitContext context{this, false, depth};
+    double result = entry.code(numbers, &context);
+
+    // Some guard failed. Nothing has been changed, so the Interpreter
+    // can start over, and it will take the function from here on.
+    if (context.bailed) {
+      entry.code = nullptr;
+      return std::nullopt;
+    }
+
+    return result;
+  }
+
+private:
+  Entry& entryFor(LoxFunction& function) {
+    auto elem = entries.find(function.declaration);
+    if (elem != entries.end()) return elem->second;
+
+    // A method numbers its parameters from after "this", which native
+    // code doesn't have, so a method is never compiled, not even when
+    // native code finds one bound in a global.
+    Entry& entry = entries[function.declaration];
+    if (!function.isInitializer && function.receiver == nullptr) {
+      entry.code = install(function);
+    }
+    return entry;
+  }
+
+  NativeCode install(LoxFunction& function) {
+#ifdef JLOX_JIT_NATIVE
+    std::optional<std::vector<std::uint8_t>> code =
+        JitCompiler{globals}.compile(function.declaration);
+    if (!code) return nullptr;
+
+    std::size_t size = code->size();
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) return nullptr;
+
+    std::memcpy(memory, code->data(), size);
+    if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+      munmap(memory, size);
+      return nullptr;
+    }
+
+    regions.emplace_back(memory, size);
+    return reinterpret_cast<NativeCode>(memory);
+#else
+    return nullptr;
+#endif
+  }
+};
+
+inline double JitCompiler::getGlobal(JitContext* context, int slot,
+                                     const double*, int) {
+  const Value* value = context->jit->globals.find(slot);
+  if (value == nullptr || !value->isNumber()) {
+    context->bailed = true;
+    return 0;
+  }
+
+  return value->asNumber();
+}
+
+inline double JitCompiler::callGlobal(JitContext* context, int slot,
+                                      const double* arguments,
+                                      int argCount) {
+  const Value* callee = context->jit->globals.find(slot);
+  if (callee == nullptr || !callee->isFunction()) {
+    context->bailed = true;
+    return 0;
+  }
+
+  LoxFunction& function = *callee->asFunction();
+  NativeCode code = nullptr;
+  if (function.arity() == argCount) {
+    code = context->jit->entryFor(function).code;
+  }
+
+  if (code == nullptr || context->depth == 0) {
+    context->bailed = true;
+    return 0;
+  }
+
+  --context->depth;
+  double result = code(arguments, context);
+  ++context->depth;
+  return result;
+}
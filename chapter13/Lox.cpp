@@ -1,62 +1,101 @@
-#include <cstring>      // std::strerror
-#include <fstream>      // readFile
+#include <cstddef>      // std::size_t
+#include <cstdlib>      // std::atof, std::atoi, std::atol, std::exit
 #include <iostream>     // std::getline
+#include <memory>
 #include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>      // std::move
 #include <vector>
+#include "Arena.h"
+#include "ClosureCompiler.h"
 #include "Error.h"
+#include "Heap.h"
 #include "Interpreter.h"
+#include "Jit.h"
+#include "Optimizer.h"
 #include "Parser.h"
 #include "Resolver.h"
 #include "Scanner.h"
+#include "SourceManager.h"
+#include "Stack.h"
+#include "VM.h"
 
 // It's not good practice to include .cpp files, but in our case it
 // allows us to lay out the files similarly to the Java code while
 // avoiding circular dependencies.
+#include "Heap.cpp"
 #include "LoxFunction.cpp" // Chapter 10 - Functions
 #include "LoxClass.cpp"    // Chapter 12 - Classes
 #include "LoxInstance.cpp" // Chapter 12 - Classes
 
-std::string readFile(std::string_view path) {
-  std::ifstream file{path.data(), std::ios::in | std::ios::binary |
-                                  std::ios::ate};
-  if (!file) {
-    std::cerr << "Failed to open file " << path << ": "
-              << std::strerror(errno) << "\n";
-    std::exit(74);
-  }
+// The Interpreter walks the AST directly and is the reference for how
+// Lox behaves. The other engines must produce exactly the same output.
+enum class Engine {
+  TREE,
+  CLOSURES,
+  VM
+};
 
-  std::string contents;
-  contents.resize(file.tellg());
+Engine engine = Engine::TREE;
 
-  file.seekg(0, std::ios::beg);
-  file.read(contents.data(), contents.size());
+Interpreter interpreter{};
 
-  return contents;
-}
+// Only used by the tree-walking engines, which call functions through
+// LoxFunction::call().
+std::unique_ptr<Jit> jit;
 
-Interpreter interpreter{};
+// Every call to run() parses its source into a fresh arena. Functions
+// and classes keep pointing into the AST of the code that declared
+// them, so any arena whose code ran must live as long as the
+// interpreter does. In the REPL that means one arena per line.
+std::vector<std::unique_ptr<Arena>> arenas;
 
 void run(std::string_view source) {
+  auto arena = std::make_unique<Arena>();
+
   Scanner scanner {source};
-  std::vector<Token> tokens = scanner.scanTokens();
-  Parser parser{tokens};
-  std::vector<std::shared_ptr<Stmt>> statements = parser.parse();
+  Parser parser{scanner, *arena};
+  std::vector<Stmt*> statements = parser.parse();
 
   // Stop if there was a syntax error.
   if (hadError) return;
 
-  Resolver resolver{interpreter};
+  Resolver resolver{};
   resolver.resolve(statements);
 
   // Stop if there was a resolution error.
   if (hadError) return;
 
-  interpreter.interpret(statements);
+  statements = Optimizer{*arena}.optimize(statements);
+
+  arenas.push_back(std::move(arena));
+
+  switch (engine) {
+    case Engine::TREE:
+      interpreter.interpret(statements);
+      break;
+    case Engine::CLOSURES:
+      ClosureCompiler{interpreter}.interpret(statements);
+      break;
+    case Engine::VM:
+      VM{interpreter}.interpret(statements);
+      break;
+  }
 }
 
-void runFile(std::string_view path) {
-  std::string contents = readFile(path);
-  run(contents);
+void runFile(const std::string& path) {
+  std::string_view source;
+  try {
+    source = sources.load(path);
+  } catch (const std::system_error& error) {
+    std::cerr << "Failed to open file " << path << ": "
+              << error.code().message() << "\n";
+    std::exit(74);
+  }
+
+  run(source);
+  heap.releaseAll();
 
   // Indicate an error in the exit code.
   if (hadError) std::exit(65);
@@ -68,18 +107,85 @@ void runPrompt() {
     std::cout << "> ";
     std::string line;
     if (!std::getline(std::cin, line)) break;
-    run(line);
+    run(sources.add(std::move(line)));
     hadError = false;
   }
+
+  heap.releaseAll();
+}
+
+// Native stack for each Lox call the program may make. A call takes
+// about a kilobyte in the tree-walking engines, and sanitizers make
+// the frames several times larger.
+constexpr std::size_t STACK_PER_CALL = 16 * 1024;
+
+void usage() {
+  std::cout <<
+      "Usage: jlox [options] [script]\n"
+      "  --engine=tree      Walk the syntax tree (default).\n"
+      "  --engine=closures  Compile the syntax tree to closures.\n"
+      "  --engine=vm        Compile to bytecode for a stack VM.\n"
+      "  --jit              Compile hot functions to native code.\n"
+      "  --jit-threshold=N  Calls before a function is hot (100).\n"
+      "  --max-depth=N      Calls that may be nested (100000).\n"
+      "  --gc-threshold=N   Objects before the first collection"
+      " (65536).\n"
+      "  --gc-growth=F      Heap growth between collections (2).\n";
+  std::exit(64);
 }
 
 int main(int argc, char* argv[]) {
-  if (argc > 2) {
-    std::cout << "Usage: jlox [script]\n";
-    std::exit(64);
-  } else if (argc == 2) {
-    runFile(argv[1]);
-  } else {
-    runPrompt();
+  bool useJit = false;
+  int jitThreshold = 100;
+  int maxDepth = 100000;
+  std::size_t gcThreshold = 64 * 1024;
+  double gcGrowth = 2;
+
+  int arg = 1;
+  for (; arg < argc && std::string_view{argv[arg]}.rfind("--", 0) == 0;
+       ++arg) {
+    std::string_view option = argv[arg];
+
+    if (option == "--engine=tree") {
+      engine = Engine::TREE;
+    } else if (option == "--engine=closures") {
+      engine = Engine::CLOSURES;
+    } else if (option == "--engine=vm") {
+      engine = Engine::VM;
+    } else if (option == "--jit") {
+      useJit = true;
+    } else if (option.rfind("--jit-threshold=", 0) == 0) {
+      jitThreshold = std::atoi(option.substr(16).data());
+    } else if (option.rfind("--max-depth=", 0) == 0) {
+      maxDepth = std::atoi(option.substr(12).data());
+    } else if (option.rfind("--gc-threshold=", 0) == 0) {
+      gcThreshold = std::atol(option.substr(15).data());
+    } else if (option.rfind("--gc-growth=", 0) == 0) {
+      gcGrowth = std::atof(option.substr(12).data());
+    } else {
+      usage();
+    }
   }
+
+  if (useJit) {
+    jit = std::make_unique<Jit>(interpreter.globals, jitThreshold);
+    interpreter.jit = jit.get();
+  }
+
+  if (argc - arg > 1) usage();
+
+  heap.configure(gcThreshold, gcGrowth);
+
+  // Deep recursion ends in a runtime error once it reaches the maximum
+  // depth, which the stack must be large enough to get to.
+  interpreter.maxCallDepth = maxDepth;
+  std::size_t stackSize = (maxDepth + 1) * STACK_PER_CALL;
+
+  runOnStack(stackSize, [&] {
+    if (argc - arg == 1) {
+      runFile(argv[arg]);
+    } else {
+      runPrompt();
+    }
+  });
 }
\ No newline at end of file
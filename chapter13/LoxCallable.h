@@ -1,16 +1,35 @@
 #pragma once
 
-#include <any>
+#include <cstddef>      // std::size_t
 #include <string>
-#include <vector>
+#include "Value.h"
 
 class Interpreter;
 
+// The arguments of a call. They are evaluated onto a stack that the
+// caller reuses for every call, rather than into a vector of their
+// own, and a callee only sees where they are. They stay there only
+// until the callee runs any Lox code, so it must take them first.
+class Arguments {
+  Value* first;
+  std::size_t count;
+
+public:
+  Arguments(Value* first, std::size_t count)
+    : first{first}, count{count}
+  {}
+
+  Value* begin() const { return first; }
+  Value* end() const { return first + count; }
+  std::size_t size() const { return count; }
+  Value& operator[](std::size_t i) const { return first[i]; }
+};
+
 class LoxCallable {
 public:
   virtual int arity() = 0;
-  virtual std::any call(Interpreter& interpreter,
-                        std::vector<std::any> arguments) = 0;
+  virtual Value call(Interpreter& interpreter,
+                     Arguments arguments) = 0;
   virtual std::string toString() = 0;
   virtual ~LoxCallable() = default;
 };
\ No newline at end of file
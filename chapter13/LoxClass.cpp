@@ -1,45 +1,64 @@
 #include "LoxClass.h"
 #include <utility>     // std::move
+#include "LoxFunction.h"
+#include "LoxInstance.h"
 
 LoxClass::LoxClass(std::string name,
     std::shared_ptr<LoxClass> superclass,
     std::map<std::string, std::shared_ptr<LoxFunction>> methods)
-  : superclass{superclass}, name{std::move(name)},
-    methods{std::move(methods)}
-{}
+  : superclass{superclass}, name{std::move(name)}
+{
+  if (superclass != nullptr) this->methods = superclass->methods;
+
+  for (auto& [methodName, method] : methods) {
+    this->methods[methodName] = std::move(method);
+  }
+
+  init = findMethod("init");
+  if (init != nullptr) initArity = init->arity();
+}
 
 std::shared_ptr<LoxFunction> LoxClass::findMethod(
-    const std::string& name) {
-  auto elem = methods.find(name);
+    std::string_view name) {
+  auto elem = methods.find(std::string{name});
   if (elem != methods.end()) {
       return elem->second;
   }
 
-  if (superclass != nullptr) {
-    return superclass->findMethod(name);
-  }
-
   return nullptr;
 }
 
+const std::shared_ptr<LoxFunction>& LoxClass::initializer() const {
+  return init;
+}
+
 std::string LoxClass::toString() {
   return name;
 }
 
-std::any LoxClass::call(Interpreter& interpreter,
-                        std::vector<std::any> arguments) {
-  auto instance = std::make_shared<LoxInstance>(shared_from_this());
-  std::shared_ptr<LoxFunction> initializer = findMethod("init");
-  if (initializer != nullptr) {
-    initializer->bind(instance)->call(interpreter,
-                                      std::move(arguments));
+Value LoxClass::call(Interpreter& interpreter,
+                     Arguments arguments) {
+  auto instance = std::make_shared<LoxInstance>(
+      std::static_pointer_cast<LoxClass>(shared_from_this()));
+  if (init != nullptr) {
+    init->invoke(interpreter, instance, arguments);
   }
 
   return instance;
 }
 
 int LoxClass::arity() {
-  std::shared_ptr<LoxFunction> initializer = findMethod("init");
-  if (initializer == nullptr) return 0;
-  return initializer->arity();
+  return initArity;
+}
+
+void LoxClass::trace(Tracer& tracer) {
+  if (superclass != nullptr) tracer.visit(superclass.get());
+  for (const auto& method : methods) tracer.visit(method.second.get());
+  if (init != nullptr) tracer.visit(init.get());
+}
+
+void LoxClass::clear() {
+  superclass = nullptr;
+  methods.clear();
+  init = nullptr;
 }
@@ -1,29 +1,45 @@
 #pragma once
 
-#include <any>
 #include <map>
 #include <memory>
 #include <string>
-#include <vector>
+#include <string_view>
+#include <unordered_map>
+#include "Heap.h"
 #include "LoxCallable.h"
+#include "Shape.h"
+#include "Value.h"
 
 class Interpreter;
 class LoxFunction;
 
-class LoxClass: public LoxCallable,
-                public std::enable_shared_from_this<LoxClass> {
+class LoxClass: public LoxCallable, public Traced {
   friend class LoxInstance;
   const std::string name;
-  const std::shared_ptr<LoxClass> superclass;
-  std::map<std::string, std::shared_ptr<LoxFunction>> methods;
+  std::shared_ptr<LoxClass> superclass;
+
+  // Every method the class responds to, inherited ones included, so
+  // finding a method never walks the superclass chain.
+  std::unordered_map<std::string, std::shared_ptr<LoxFunction>>
+      methods;
+
+  // Looked up once rather than on every instantiation.
+  std::shared_ptr<LoxFunction> init;
+  int initArity = 0;
+
+  // The shape of a new instance, before it has any fields.
+  const std::shared_ptr<Shape> shape = std::make_shared<Shape>();
 
 public:
   LoxClass(std::string name, std::shared_ptr<LoxClass> superclass,
       std::map<std::string, std::shared_ptr<LoxFunction>> methods);
 
-  std::shared_ptr<LoxFunction> findMethod(const std::string& name);
+  std::shared_ptr<LoxFunction> findMethod(std::string_view name);
+  const std::shared_ptr<LoxFunction>& initializer() const;
   std::string toString() override;
-  std::any call(Interpreter& interpreter,
-                std::vector<std::any> arguments) override;
+  Value call(Interpreter& interpreter,
+             Arguments arguments) override;
   int arity() override;
+  void trace(Tracer& tracer) override;
+  void clear() override;
 };
@@ -1,11 +1,14 @@
 #include "LoxFunction.h"
+#include <optional>
 #include <utility>        // std::move
 #include "Environment.h"
+#include "Heap.h"
 #include "LoxInstance.h"
 #include "Interpreter.h"
+#include "Jit.h"
 #include "Stmt.h"
 
-LoxFunction::LoxFunction(std::shared_ptr<Function> declaration,
+LoxFunction::LoxFunction(Function* declaration,
                          std::shared_ptr<Environment> closure,
                          bool isInitializer)
   : isInitializer{isInitializer}, closure{std::move(closure)},
@@ -14,37 +17,93 @@ LoxFunction::LoxFunction(std::shared_ptr<Function> declaration,
 
 std::shared_ptr<LoxFunction> LoxFunction::bind(
     std::shared_ptr<LoxInstance> instance) {
-  auto environment = std::make_shared<Environment>(closure);
-  environment->define("this", instance);
-  return std::make_shared<LoxFunction>(declaration, environment,
-                                       isInitializer);
+  auto bound = std::make_shared<LoxFunction>(*this);
+  bound->receiver = std::move(instance);
+  return bound;
 }
 
 std::string LoxFunction::toString() {
-  return "<fn " + declaration->name.lexeme + ">";
+  return "<fn " + std::string{declaration->name.lexeme} + ">";
 }
 
 int LoxFunction::arity() {
   return declaration->params.size();
 }
 
-std::any LoxFunction::call(Interpreter& interpreter,
-                           std::vector<std::any> arguments) {
-  auto environment = std::make_shared<Environment>(closure);
-  for (int i = 0; i < declaration->params.size(); ++i) {
-    environment->define(declaration->params[i].lexeme,
-        arguments[i]);
-  }
+void LoxFunction::trace(Tracer& tracer) {
+  if (closure != nullptr) tracer.visit(closure.get());
+  if (receiver != nullptr) tracer.visit(receiver.get());
+}
 
-  try {
-    interpreter.executeBlock(declaration->body, environment);
-  } catch (LoxReturn returnValue) {
-    if (isInitializer) return closure->getAt(0, "this");
+void LoxFunction::clear() {
+  closure = nullptr;
+  receiver = nullptr;
+}
 
-    return returnValue.value;
+Value LoxFunction::execute(Interpreter& interpreter,
+                           std::shared_ptr<Environment> environment) {
+  Completion completion = interpreter.executeBlock(
+      declaration->body, std::move(environment));
+  if (completion == Completion::RETURN) {
+    return std::move(interpreter.returnValue);
   }
 
-  if (isInitializer) return closure->getAt(0, "this");
-
   return nullptr;
 }
+
+Value LoxFunction::call(Interpreter& interpreter,
+                        Arguments arguments) {
+  return invoke(interpreter, receiver, arguments);
+}
+
+Value LoxFunction::invoke(Interpreter& interpreter,
+                          const std::shared_ptr<LoxInstance>& receiver,
+                          Arguments arguments) {
+  // A tail call the body left behind is made here, in a loop, so that
+  // tail recursion runs in this one C++ frame. The environment of each
+  // call is released before the next one gets its own.
+  LoxFunction* function = this;
+  std::shared_ptr<LoxFunction> tailFunction;
+  std::shared_ptr<LoxInstance> instance = receiver;
+
+  for (;;) {
+    heap.collectIfNeeded();
+
+    // Once a function is hot, the JIT tries to run it as native code.
+    // It declines the call if it can't. Native code has no "this", so
+    // methods always stay in the interpreter.
+    Jit* jit = interpreter.jit;
+    if (jit != nullptr && instance == nullptr &&
+        ++function->calls > jit->threshold) {
+      std::optional<Value> result = jit->call(
+          *function, arguments,
+          interpreter.maxCallDepth - interpreter.callDepth);
+      if (result) return *result;
+    }
+
+    // The arguments are moved straight from where the caller evaluated
+    // them into the environment, which has room for every local.
+    auto environment = std::make_shared<Environment>(
+        function->closure, function->declaration->locals);
+    if (instance != nullptr) environment->define(instance);
+    for (Value& argument : arguments) {
+      environment->define(std::move(argument));
+    }
+
+    Value result = function->execute(interpreter,
+                                     std::move(environment));
+
+    Interpreter::TailCall& tailCall = interpreter.tailCall;
+    if (tailCall.function == nullptr) {
+      if (function->isInitializer) return instance;
+      return result;
+    }
+
+    tailFunction = std::move(tailCall.function);
+    function = tailFunction.get();
+    instance = tailCall.receiver != nullptr
+        ? std::move(tailCall.receiver) : function->receiver;
+    arguments = Arguments{tailCall.arguments.data(),
+                          tailCall.arguments.size()};
+  }
+}
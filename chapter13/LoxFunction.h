@@ -1,29 +1,57 @@
 #pragma once
 
-#include <any>
 #include <memory>
 #include <string>
-#include <vector>
+#include "Heap.h"
 #include "LoxCallable.h"
+#include "Value.h"
 
 class Environment;
 class Function;
 class LoxInstance;
 
-class LoxFunction: public LoxCallable {
-  std::shared_ptr<Function> declaration;
+class LoxFunction: public LoxCallable, public Traced {
+  friend class Jit;
+
+  // Calls so far, to find out whether the function is hot.
+  int calls = 0;
+
+protected:
+  Function* declaration;
   std::shared_ptr<Environment> closure;
 
+  // The instance a method has been bound to. Bound methods are only
+  // created when a method is used as a value, since calling one
+  // right away passes the instance to invoke() instead.
+  std::shared_ptr<LoxInstance> receiver;
+
   bool isInitializer;
 
+  // Runs the body in the environment call() set up for it, and
+  // returns what the body returned. Engines that execute something
+  // other than the AST override this, along with bind(), which must
+  // produce a function of the same kind.
+  virtual Value execute(Interpreter& interpreter,
+                        std::shared_ptr<Environment> environment);
+
 public:
-  LoxFunction(std::shared_ptr<Function> declaration,
+  LoxFunction(Function* declaration,
               std::shared_ptr<Environment> closure,
               bool isInitializer);
-  std::shared_ptr<LoxFunction> bind(
+  virtual std::shared_ptr<LoxFunction> bind(
       std::shared_ptr<LoxInstance> instance);
   std::string toString() override;
   int arity() override;
-  std::any call(Interpreter& interpreter,
-                std::vector<std::any> arguments) override;
+  Value call(Interpreter& interpreter,
+             Arguments arguments) override;
+  void trace(Tracer& tracer) override;
+  void clear() override;
+
+  // Calls a method with the given instance as "this", which goes in
+  // the first slot of the method's environment. Functions that aren't
+  // methods take a null receiver. Tail calls the function makes are
+  // made here too, after it returns.
+  Value invoke(Interpreter& interpreter,
+               const std::shared_ptr<LoxInstance>& receiver,
+               Arguments arguments);
 };
@@ -3,27 +3,81 @@
 #include "Error.h"
 
 LoxInstance::LoxInstance(std::shared_ptr<LoxClass> klass)
-  : klass{std::move(klass)}
+  : klass{std::move(klass)}, shape{this->klass->shape}
 {}
 
-std::any LoxInstance::get(const Token& name) {
-  auto elem = fields.find(name.lexeme);
-  if (elem != fields.end()) {
-    return elem->second;
+Value LoxInstance::get(const Token& name, PropertyCache& cache) {
+  std::shared_ptr<LoxFunction> method = getMethod(name, cache);
+  if (method != nullptr) {
+    return method->bind(
+        std::static_pointer_cast<LoxInstance>(shared_from_this()));
+  }
+
+  return fields[cache.slot];
+}
+
+std::shared_ptr<LoxFunction> LoxInstance::getMethod(
+    const Token& name, PropertyCache& cache) {
+  if (cache.shape != shape) lookUp(name, cache);
+  return cache.method.lock();
+}
+
+void LoxInstance::lookUp(const Token& name, PropertyCache& cache) {
+  int slot = shape->find(name.lexeme);
+  if (slot != -1) {
+    cache = PropertyCache::forField(shape, slot);
+    return;
   }
 
   std::shared_ptr<LoxFunction> method =
       klass->findMethod(name.lexeme);
-  if (method != nullptr) return method->bind(shared_from_this());
+  if (method != nullptr) {
+    cache = PropertyCache::forMethod(shape, method);
+    return;
+  }
 
   throw RuntimeError(name,
-      "Undefined property '" + name.lexeme + "'.");
+      "Undefined property '" + std::string{name.lexeme} + "'.");
 }
 
-void LoxInstance::set(const Token& name, std::any value) {
-  fields[name.lexeme] = std::move(value);
+void LoxInstance::set(const Token& name, Value value,
+                      PropertyCache& cache) {
+  if (cache.shape == shape) {
+    if (cache.next == nullptr) {
+      fields[cache.slot] = std::move(value);
+    } else {
+      shape = cache.next;
+      fields.push_back(std::move(value));
+    }
+
+    return;
+  }
+
+  int slot = shape->find(name.lexeme);
+  if (slot != -1) {
+    cache = PropertyCache::forField(shape, slot);
+    fields[slot] = std::move(value);
+    return;
+  }
+
+  // A new field goes in the next slot.
+  const std::shared_ptr<Shape>& next = shape->add(name.lexeme);
+  cache = PropertyCache::forTransition(
+      shape, static_cast<int>(fields.size()), next);
+  shape = next;
+  fields.push_back(std::move(value));
 }
 
 std::string LoxInstance::toString() {
   return klass->name + " instance";
 }
+
+void LoxInstance::trace(Tracer& tracer) {
+  tracer.visit(klass.get());
+  for (const Value& field : fields) tracer.visit(field);
+}
+
+void LoxInstance::clear() {
+  klass = nullptr;
+  fields.clear();
+}
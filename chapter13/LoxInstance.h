@@ -1,20 +1,39 @@
 #pragma once
 
-#include <any>
-#include <map>
 #include <memory>
 #include <string>
+#include <vector>
+#include "Heap.h"
+#include "Shape.h"
+#include "Value.h"
 
 class LoxClass;
 class Token;
 
-class LoxInstance: public std::enable_shared_from_this<LoxInstance> {
+class LoxInstance: public Traced {
   std::shared_ptr<LoxClass> klass;
-  std::map<std::string, std::any> fields;
+
+  // The values of the fields, in the slots given by the shape.
+  std::shared_ptr<Shape> shape;
+  std::vector<Value> fields;
 
 public:
   LoxInstance(std::shared_ptr<LoxClass> klass);
-  std::any get(const Token& name);
-  void set(const Token& name, std::any value);
+
+  // Each property access in the program passes its own cache.
+  Value get(const Token& name, PropertyCache& cache);
+  void set(const Token& name, Value value, PropertyCache& cache);
+
+  // Looks up a property that is about to be called. A method comes
+  // back unbound, to be invoked with this instance. If the property
+  // is a field instead, the result is null and get() will hit the
+  // cache.
+  std::shared_ptr<LoxFunction> getMethod(const Token& name,
+                                         PropertyCache& cache);
   std::string toString();
+  void trace(Tracer& tracer) override;
+  void clear() override;
+
+private:
+  void lookUp(const Token& name, PropertyCache& cache);
 };
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <algorithm>    // std::max
+#include <charconv>
+#include <cmath>        // std::fabs, std::isfinite
+#include <cstddef>      // std::size_t
+#include <cstdint>      // std::int64_t
+#include <cstdio>       // std::snprintf
+#include <cstdlib>      // std::atoi, std::strtod
+#include <cstring>      // std::strchr
+#include <string>
+#include <string_view>
+
+// std::from_chars and std::to_chars for doubles came to the standard
+// libraries later than the rest of C++17. Where they're missing, the
+// C library does the same work, only more slowly.
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+#define JLOX_FLOAT_CHARS
+#endif
+
+// Enough for any double the way it is written below, such as
+// "-2.2250738585072014e-308" or "-0.00000012345678901234567".
+constexpr int NUMBER_LENGTH = 32;
+
+// A number literal is one or more digits, possibly with a fractional
+// part. Most of them are small integers, which are read exactly
+// without involving the library at all. Below 10^15 every integer is
+// a double.
+inline double parseNumber(std::string_view text) {
+  if (text.length() <= 15 &&
+      text.find('.') == std::string_view::npos) {
+    std::int64_t integer = 0;
+    for (char c : text) integer = integer * 10 + (c - '0');
+    return static_cast<double>(integer);
+  }
+
+#ifdef JLOX_FLOAT_CHARS
+  double number = 0;
+  std::from_chars(text.data(), text.data() + text.length(), number);
+  return number;
+#else
+  return std::strtod(std::string{text}.c_str(), nullptr);
+#endif
+}
+
+// Numbers from 1e-7 up to 1e21 are written out in full, like 100000
+// and 0.0001, and the rest in scientific notation, like 1e+21. Either
+// way the number has as few digits as it takes to read back as the
+// same double, so 3 is written "3" and 0.1 is "0.1" rather than
+// "0.100000". Returns the text, which is in the buffer.
+inline std::string_view formatNumber(double number,
+                                     char (&buffer)[NUMBER_LENGTH]) {
+  double magnitude = std::fabs(number);
+  bool fixed = number == 0 || (magnitude >= 1e-7 && magnitude < 1e21);
+
+#ifdef JLOX_FLOAT_CHARS
+  std::to_chars_result result = std::to_chars(
+      buffer, buffer + NUMBER_LENGTH, number,
+      fixed ? std::chars_format::fixed : std::chars_format::scientific);
+  std::size_t length = result.ptr - buffer;
+  return std::string_view{buffer, length};
+#else
+  int length;
+  if (!std::isfinite(number)) {
+    length = std::snprintf(buffer, NUMBER_LENGTH, "%g", number);
+    return std::string_view{buffer, static_cast<std::size_t>(length)};
+  }
+
+  // Finds how many digits it takes in scientific notation, which also
+  // tells where the point goes.
+  int precision = 0;
+  for (; precision < 17; ++precision) {
+    length = std::snprintf(buffer, NUMBER_LENGTH, "%.*e", precision,
+                           number);
+    if (std::strtod(buffer, nullptr) == number) break;
+  }
+
+  if (fixed) {
+    int exponent = std::atoi(std::strchr(buffer, 'e') + 1);
+    length = std::snprintf(buffer, NUMBER_LENGTH, "%.*f",
+                           std::max(precision - exponent, 0), number);
+  }
+
+  return std::string_view{buffer, static_cast<std::size_t>(length)};
+#endif
+}
@@ -0,0 +1,328 @@
+#pragma once
+
+#include <utility>      // std::move
+#include <vector>
+#include "Arena.h"
+#include "Expr.h"
+#include "Stmt.h"
+#include "Token.h"
+#include "Value.h"
+
+// Runs between the Resolver and the engines, evaluating whatever can
+// be known before the program runs. Operators whose operands are all
+// literals are replaced by their result, groupings by what they
+// contain, and if and while statements with constant conditions by
+// the code that would actually run.
+//
+// Operations that would fail at runtime are left alone, so the error
+// is still reported when, and on the line where, it happens. Nodes
+// are never changed in place: a node whose children changed is copied
+// into the arena with the new children, along with whatever the
+// Resolver recorded on it.
+class Optimizer: public ExprVisitor<Expr*>,
+                 public StmtVisitor<Stmt*> {
+  Arena& arena;
+
+public:
+  Optimizer(Arena& arena)
+    : arena{arena}
+  {}
+
+  std::vector<Stmt*> optimize(const std::vector<Stmt*>& statements) {
+    std::vector<Stmt*> optimized;
+    optimize(statements, optimized);
+    return optimized;
+  }
+
+private:
+  Expr* optimize(Expr* expr) {
+    return expr->accept(*this);
+  }
+
+  // Returns null if the statement can be removed.
+  Stmt* optimize(Stmt* stmt) {
+    return stmt->accept(*this);
+  }
+
+  // A statement that must stay a statement, like the branch of an if,
+  // becomes an empty block if there is nothing left of it.
+  Stmt* optimizeBranch(Stmt* stmt) {
+    Stmt* optimized = optimize(stmt);
+    if (optimized != nullptr) return optimized;
+    return arena.make<Block>(std::vector<Stmt*>{});
+  }
+
+  // Returns whether any statement changed.
+  bool optimize(const std::vector<Stmt*>& statements,
+                std::vector<Stmt*>& optimized) {
+    bool changed = false;
+    for (Stmt* statement : statements) {
+      Stmt* result = optimize(statement);
+      if (result != statement) changed = true;
+      if (result != nullptr) optimized.push_back(result);
+    }
+
+    return changed;
+  }
+
+  Function* optimizeFunction(Function* function) {
+    std::vector<Stmt*> body;
+    if (!optimize(function->body, body)) return function;
+
+    auto* optimized = arena.make<Function>(
+        function->name, function->params, std::move(body));
+    optimized->locals = function->locals;
+    return optimized;
+  }
+
+  Expr* literal(Value value) {
+    return arena.make<Literal>(std::move(value));
+  }
+
+public:
+  Stmt* visitBlockStmt(Block* stmt) override {
+    std::vector<Stmt*> statements;
+    if (!optimize(stmt->statements, statements)) return stmt;
+    return arena.make<Block>(std::move(statements));
+  }
+
+  Stmt* visitClassStmt(Class* stmt) override {
+    bool changed = false;
+    std::vector<Function*> methods;
+    for (Function* method : stmt->methods) {
+      methods.push_back(optimizeFunction(method));
+      if (methods.back() != method) changed = true;
+    }
+
+    if (!changed) return stmt;
+    return arena.make<Class>(stmt->name, stmt->superclass,
+                             std::move(methods));
+  }
+
+  Stmt* visitExpressionStmt(Expression* stmt) override {
+    Expr* expression = optimize(stmt->expression);
+
+    // A constant on its own does nothing.
+    if (expression->type == ExprType::LITERAL) return nullptr;
+
+    if (expression == stmt->expression) return stmt;
+    return arena.make<Expression>(expression);
+  }
+
+  Stmt* visitFunctionStmt(Function* stmt) override {
+    return optimizeFunction(stmt);
+  }
+
+  Stmt* visitIfStmt(If* stmt) override {
+    Expr* condition = optimize(stmt->condition);
+
+    // Branches can't declare variables outside of a block, so either
+    // one can take the place of the whole statement.
+    if (condition->type == ExprType::LITERAL) {
+      if (isTruthy(static_cast<Literal*>(condition)->value)) {
+        return optimize(stmt->thenBranch);
+      }
+
+      if (stmt->elseBranch == nullptr) return nullptr;
+      return optimize(stmt->elseBranch);
+    }
+
+    Stmt* thenBranch = optimizeBranch(stmt->thenBranch);
+    Stmt* elseBranch = nullptr;
+    if (stmt->elseBranch != nullptr) {
+      elseBranch = optimize(stmt->elseBranch);
+    }
+
+    if (condition == stmt->condition &&
+        thenBranch == stmt->thenBranch &&
+        elseBranch == stmt->elseBranch) {
+      return stmt;
+    }
+
+    return arena.make<If>(condition, thenBranch, elseBranch);
+  }
+
+  Stmt* visitPrintStmt(Print* stmt) override {
+    Expr* expression = optimize(stmt->expression);
+    if (expression == stmt->expression) return stmt;
+    return arena.make<Print>(expression);
+  }
+
+  Stmt* visitReturnStmt(Return* stmt) override {
+    if (stmt->value == nullptr) return stmt;
+
+    Expr* value = optimize(stmt->value);
+    if (value == stmt->value) return stmt;
+    return arena.make<Return>(stmt->keyword, value);
+  }
+
+  Stmt* visitVarStmt(Var* stmt) override {
+    if (stmt->initializer == nullptr) return stmt;
+
+    Expr* initializer = optimize(stmt->initializer);
+    if (initializer == stmt->initializer) return stmt;
+    return arena.make<Var>(stmt->name, initializer);
+  }
+
+  Stmt* visitWhileStmt(While* stmt) override {
+    Expr* condition = optimize(stmt->condition);
+
+    if (condition->type == ExprType::LITERAL &&
+        !isTruthy(static_cast<Literal*>(condition)->value)) {
+      return nullptr;
+    }
+
+    Stmt* body = optimizeBranch(stmt->body);
+    if (condition == stmt->condition && body == stmt->body) return stmt;
+    return arena.make<While>(condition, body);
+  }
+
+  Expr* visitAssignExpr(Assign* expr) override {
+    Expr* value = optimize(expr->value);
+    if (value == expr->value) return expr;
+
+    auto* assign = arena.make<Assign>(expr->name, value);
+    assign->depth = expr->depth;
+    assign->slot = expr->slot;
+    return assign;
+  }
+
+  Expr* visitBinaryExpr(Binary* expr) override {
+    Expr* left = optimize(expr->left);
+    Expr* right = optimize(expr->right);
+
+    if (left->type == ExprType::LITERAL &&
+        right->type == ExprType::LITERAL) {
+      const Value& a = static_cast<Literal*>(left)->value;
+      const Value& b = static_cast<Literal*>(right)->value;
+
+      switch (expr->op.type) {
+        case BANG_EQUAL: return literal(!(a == b));
+        case EQUAL_EQUAL: return literal(a == b);
+        case PLUS:
+          if (a.isString() && b.isString()) {
+            return literal(a.asString() + b.asString());
+          }
+          break;
+        default:
+          break;
+      }
+
+      if (a.isNumber() && b.isNumber()) {
+        double x = a.asNumber();
+        double y = b.asNumber();
+
+        switch (expr->op.type) {
+          case GREATER: return literal(x > y);
+          case GREATER_EQUAL: return literal(x >= y);
+          case LESS: return literal(x < y);
+          case LESS_EQUAL: return literal(x <= y);
+          case MINUS: return literal(x - y);
+          case PLUS: return literal(x + y);
+          case SLASH: return literal(x / y);
+          case STAR: return literal(x * y);
+          default: break;
+        }
+      }
+    }
+
+    if (left == expr->left && right == expr->right) return expr;
+    return arena.make<Binary>(left, expr->op, right);
+  }
+
+  Expr* visitCallExpr(Call* expr) override {
+    Expr* callee = optimize(expr->callee);
+    bool changed = callee != expr->callee;
+
+    std::vector<Expr*> arguments;
+    for (Expr* argument : expr->arguments) {
+      arguments.push_back(optimize(argument));
+      if (arguments.back() != argument) changed = true;
+    }
+
+    if (!changed) return expr;
+
+    auto* call = arena.make<Call>(callee, expr->paren,
+                                  std::move(arguments));
+    call->tail = expr->tail;
+    return call;
+  }
+
+  Expr* visitGetExpr(Get* expr) override {
+    Expr* object = optimize(expr->object);
+    if (object == expr->object) return expr;
+    return arena.make<Get>(object, expr->name);
+  }
+
+  // Only the parser cares about grouping.
+  Expr* visitGroupingExpr(Grouping* expr) override {
+    return optimize(expr->expression);
+  }
+
+  Expr* visitLiteralExpr(Literal* expr) override {
+    return expr;
+  }
+
+  // A constant left operand decides whether the right one matters.
+  Expr* visitLogicalExpr(Logical* expr) override {
+    Expr* left = optimize(expr->left);
+
+    if (left->type == ExprType::LITERAL) {
+      bool truthy = isTruthy(static_cast<Literal*>(left)->value);
+      if (expr->op.type == OR ? truthy : !truthy) return left;
+      return optimize(expr->right);
+    }
+
+    Expr* right = optimize(expr->right);
+    if (left == expr->left && right == expr->right) return expr;
+    return arena.make<Logical>(left, expr->op, right);
+  }
+
+  Expr* visitSetExpr(Set* expr) override {
+    Expr* object = optimize(expr->object);
+    Expr* value = optimize(expr->value);
+    if (object == expr->object && value == expr->value) return expr;
+    return arena.make<Set>(object, expr->name, value);
+  }
+
+  Expr* visitSuperExpr(Super* expr) override {
+    return expr;
+  }
+
+  Expr* visitThisExpr(This* expr) override {
+    return expr;
+  }
+
+  Expr* visitUnaryExpr(Unary* expr) override {
+    Expr* right = optimize(expr->right);
+
+    if (right->type == ExprType::LITERAL) {
+      const Value& value = static_cast<Literal*>(right)->value;
+
+      switch (expr->op.type) {
+        case BANG: return literal(!isTruthy(value));
+        case MINUS:
+          if (value.isNumber()) return literal(-value.asNumber());
+          break;
+        default:
+          break;
+      }
+    }
+
+    if (right == expr->right) return expr;
+    return arena.make<Unary>(expr->op, right);
+  }
+
+  Expr* visitVariableExpr(Variable* expr) override {
+    return expr;
+  }
+
+private:
+  static bool isTruthy(const Value& value) {
+    switch (value.type()) {
+      case ValueType::NIL: return false;
+      case ValueType::BOOL: return value.asBool();
+      default: return true;
+    }
+  }
+};
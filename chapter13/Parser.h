@@ -1,14 +1,16 @@
 #pragma once
 
 #include <cassert>
-#include <memory>
+#include <optional>
 #include <stdexcept>
 #include <string>
 #include <string_view>
 #include <utility>      // std::move
 #include <vector>
+#include "Arena.h"
 #include "Error.h"
 #include "Expr.h"
+#include "Scanner.h"
 #include "Stmt.h"
 #include "Token.h"
 #include "TokenType.h"
@@ -18,16 +20,27 @@ class Parser {
     using std::runtime_error::runtime_error;
   };
 
-  const std::vector<Token>& tokens;
+  // The parser never looks further ahead than the next token or
+  // further back than the one before it, so rather than scanning the
+  // whole source up front, it asks the scanner for each token as it
+  // gets to it and keeps just those two. A token the parser needs to
+  // hold on to any longer is copied out.
+  Scanner& scanner;
+  std::optional<Token> tokens[2];
   int current = 0;
 
+  // Every node the parser creates is owned by the arena.
+  Arena& arena;
+
 public:
-  Parser(const std::vector<Token>& tokens)
-    : tokens{tokens}
-  {}
+  Parser(Scanner& scanner, Arena& arena)
+    : scanner{scanner}, arena{arena}
+  {
+    tokens[0].emplace(scanner.nextToken());
+  }
 
-  std::vector<std::shared_ptr<Stmt>> parse() {
-    std::vector<std::shared_ptr<Stmt>> statements;
+  std::vector<Stmt*> parse() {
+    std::vector<Stmt*> statements;
     while (!isAtEnd()) {
       statements.push_back(declaration());
     }
@@ -36,11 +49,11 @@ public:
   }
 
 private:
-  std::shared_ptr<Expr> expression() {
+  Expr* expression() {
     return assignment();
   }
 
-  std::shared_ptr<Stmt> declaration() {
+  Stmt* declaration() {
     try {
       if (match(CLASS)) return classDeclaration();
       if (match(FUN)) return function("function");
@@ -53,44 +66,44 @@ private:
     }
   }
 
-  std::shared_ptr<Stmt> classDeclaration() {
+  Stmt* classDeclaration() {
     Token name = consume(IDENTIFIER, "Expect class name.");
 
-    std::shared_ptr<Variable> superclass = nullptr;
+    Variable* superclass = nullptr;
     if (match(LESS)) {
       consume(IDENTIFIER, "Expect superclass name.");
-      superclass = std::make_shared<Variable>(previous());
+      superclass = arena.make<Variable>(previous());
     }
 
     consume(LEFT_BRACE, "Expect '{' before class body.");
 
-    std::vector<std::shared_ptr<Function>> methods;
+    std::vector<Function*> methods;
     while (!check(RIGHT_BRACE) && !isAtEnd()) {
       methods.push_back(function("method"));
     }
 
     consume(RIGHT_BRACE, "Expect '}' after class body");
 
-    return std::make_shared<Class>(std::move(name),
-                                   superclass,
-                                   std::move(methods));
+    return arena.make<Class>(name,
+                             superclass,
+                             std::move(methods));
   }
 
-  std::shared_ptr<Stmt> statement() {
+  Stmt* statement() {
     if (match(FOR)) return forStatement();
     if (match(IF)) return ifStatement();
     if (match(PRINT)) return printStatement();
     if (match(RETURN)) return returnStatement();
     if (match(WHILE)) return whileStatement();
-    if (match(LEFT_BRACE)) return std::make_shared<Block>(block());
+    if (match(LEFT_BRACE)) return arena.make<Block>(block());
 
     return expressionStatement();
   }
 
-  std::shared_ptr<Stmt> forStatement() {
+  Stmt* forStatement() {
     consume(LEFT_PAREN, "Expect '(' after 'for'.");
 
-    std::shared_ptr<Stmt> initializer;
+    Stmt* initializer;
     if (match(SEMICOLON)) {
       initializer = nullptr;
     } else if (match(VAR)) {
@@ -99,98 +112,98 @@ private:
       initializer = expressionStatement();
     }
 
-    std::shared_ptr<Expr> condition = nullptr;
+    Expr* condition = nullptr;
     if (!check(SEMICOLON)) {
       condition = expression();
     }
     consume(SEMICOLON, "Expect ';' after loop condition.");
 
-    std::shared_ptr<Expr> increment = nullptr;
+    Expr* increment = nullptr;
     if (!check(RIGHT_PAREN)) {
       increment = expression();
     }
     consume(RIGHT_PAREN, "Expect ')' after for clauses.");
-    std::shared_ptr<Stmt> body = statement();
+    Stmt* body = statement();
 
     if (increment != nullptr) {
-      body = std::make_shared<Block>(
-          std::vector<std::shared_ptr<Stmt>>{
+      body = arena.make<Block>(
+          std::vector<Stmt*>{
               body,
-              std::make_shared<Expression>(increment)});
+              arena.make<Expression>(increment)});
     }
 
     if (condition == nullptr) {
-      condition = std::make_shared<Literal>(true);
+      condition = arena.make<Literal>(true);
     }
-    body = std::make_shared<While>(condition, body);
+    body = arena.make<While>(condition, body);
 
     if (initializer != nullptr) {
-      body = std::make_shared<Block>(
-          std::vector<std::shared_ptr<Stmt>>{initializer, body});
+      body = arena.make<Block>(
+          std::vector<Stmt*>{initializer, body});
     }
 
     return body;
   }
 
-  std::shared_ptr<Stmt> ifStatement() {
+  Stmt* ifStatement() {
     consume(LEFT_PAREN, "Expect '(' after 'if'.");
-    std::shared_ptr<Expr> condition = expression();
+    Expr* condition = expression();
     consume(RIGHT_PAREN, "Expect ')' after if condition.");
 
-    std::shared_ptr<Stmt> thenBranch = statement();
-    std::shared_ptr<Stmt> elseBranch = nullptr;
+    Stmt* thenBranch = statement();
+    Stmt* elseBranch = nullptr;
     if (match(ELSE)) {
       elseBranch = statement();
     }
 
-    return std::make_shared<If>(condition, thenBranch, elseBranch);
+    return arena.make<If>(condition, thenBranch, elseBranch);
   }
 
-  std::shared_ptr<Stmt> printStatement() {
-    std::shared_ptr<Expr> value = expression();
+  Stmt* printStatement() {
+    Expr* value = expression();
     consume(SEMICOLON, "Expect ';' after value.");
-    return std::make_shared<Print>(value);
+    return arena.make<Print>(value);
   }
 
-  std::shared_ptr<Stmt> returnStatement() {
+  Stmt* returnStatement() {
     Token keyword = previous();
-    std::shared_ptr<Expr> value = nullptr;
+    Expr* value = nullptr;
     if (!check(SEMICOLON)) {
       value = expression();
     }
 
     consume(SEMICOLON, "Expect ';' after return value.");
-    return std::make_shared<Return>(keyword, value);
+    return arena.make<Return>(keyword, value);
   }
 
-  std::shared_ptr<Stmt> varDeclaration() {
+  Stmt* varDeclaration() {
     Token name = consume(IDENTIFIER, "Expect variable name.");
 
-    std::shared_ptr<Expr> initializer = nullptr;
+    Expr* initializer = nullptr;
     if (match(EQUAL)) {
       initializer = expression();
     }
 
     consume(SEMICOLON, "Expect ';' after variable declaration.");
-    return std::make_shared<Var>(std::move(name), initializer);
+    return arena.make<Var>(name, initializer);
   }
 
-  std::shared_ptr<Stmt> whileStatement() {
+  Stmt* whileStatement() {
     consume(LEFT_PAREN, "Expect '(' after 'while'.");
-    std::shared_ptr<Expr> condition = expression();
+    Expr* condition = expression();
     consume(RIGHT_PAREN, "Expect ')' after condition.");
-    std::shared_ptr<Stmt> body = statement();
+    Stmt* body = statement();
 
-    return std::make_shared<While>(condition, body);
+    return arena.make<While>(condition, body);
   }
 
-  std::shared_ptr<Stmt> expressionStatement() {
-    std::shared_ptr<Expr> expr = expression();
+  Stmt* expressionStatement() {
+    Expr* expr = expression();
     consume(SEMICOLON, "Expect ';' after expression.");
-    return std::make_shared<Expression>(expr);
+    return arena.make<Expression>(expr);
   }
 
-  std::shared_ptr<Function> function(std::string kind) {
+  Function* function(std::string kind) {
     Token name = consume(IDENTIFIER, "Expect " + kind + " name.");
     consume(LEFT_PAREN, "Expect '(' after " + kind + " name.");
     std::vector<Token> parameters;
@@ -207,14 +220,14 @@ private:
     consume(RIGHT_PAREN, "Expect ')' after parameters.");
 
     consume(LEFT_BRACE, "Expect '{' before " + kind + " body.");
-    std::vector<std::shared_ptr<Stmt>> body = block();
-    return std::make_shared<Function>(std::move(name),
-                                      std::move(parameters),
-                                      std::move(body));
+    std::vector<Stmt*> body = block();
+    return arena.make<Function>(name,
+                                std::move(parameters),
+                                std::move(body));
   }
 
-  std::vector<std::shared_ptr<Stmt>> block() {
-    std::vector<std::shared_ptr<Stmt>> statements;
+  std::vector<Stmt*> block() {
+    std::vector<Stmt*> statements;
 
     while (!check(RIGHT_BRACE) && !isAtEnd()) {
       statements.push_back(declaration());
@@ -224,110 +237,111 @@ private:
     return statements;
   }
 
-  std::shared_ptr<Expr> assignment() {
-    std::shared_ptr<Expr> expr = orExpression();
+  Expr* assignment() {
+    Expr* expr = orExpression();
 
     if (match(EQUAL)) {
       Token equals = previous();
-      std::shared_ptr<Expr> value = assignment();
-
-      if (Variable* e = dynamic_cast<Variable*>(expr.get())) {
-        Token name = e->name;
-        return std::make_shared<Assign>(std::move(name), value);
-      } else if (Get* get = dynamic_cast<Get*>(expr.get())) {
-        return std::make_shared<Set>(get->object, get->name, value);
+      Expr* value = assignment();
+
+      if (expr->type == ExprType::VARIABLE) {
+        const Token& name = static_cast<Variable*>(expr)->name;
+        return arena.make<Assign>(name, value);
+      } else if (expr->type == ExprType::GET) {
+        Get* get = static_cast<Get*>(expr);
+        return arena.make<Set>(get->object, get->name, value);
       }
 
-      error(std::move(equals), "Invalid assignment target.");
+      error(equals, "Invalid assignment target.");
     }
 
     return expr;
   }
 
-  std::shared_ptr<Expr> orExpression() {
-    std::shared_ptr<Expr> expr = andExpression();
+  Expr* orExpression() {
+    Expr* expr = andExpression();
 
     while (match(OR)) {
       Token op = previous();
-      std::shared_ptr<Expr> right = andExpression();
-      expr = std::make_shared<Logical>(expr, std::move(op), right);
+      Expr* right = andExpression();
+      expr = arena.make<Logical>(expr, op, right);
     }
 
     return expr;
   }
 
-  std::shared_ptr<Expr> andExpression() {
-    std::shared_ptr<Expr> expr = equality();
+  Expr* andExpression() {
+    Expr* expr = equality();
 
     while (match(AND)) {
       Token op = previous();
-      std::shared_ptr<Expr> right = equality();
-      expr = std::make_shared<Logical>(expr, std::move(op), right);
+      Expr* right = equality();
+      expr = arena.make<Logical>(expr, op, right);
     }
 
     return expr;
   }
 
-  std::shared_ptr<Expr> equality() {
-    std::shared_ptr<Expr> expr = comparison();
+  Expr* equality() {
+    Expr* expr = comparison();
 
     while (match(BANG_EQUAL, EQUAL_EQUAL)) {
       Token op = previous();
-      std::shared_ptr<Expr> right = comparison();
-      expr = std::make_shared<Binary>(expr, std::move(op), right);
+      Expr* right = comparison();
+      expr = arena.make<Binary>(expr, op, right);
     }
 
     return expr;
   }
 
-  std::shared_ptr<Expr> comparison() {
-    std::shared_ptr<Expr> expr = term();
+  Expr* comparison() {
+    Expr* expr = term();
 
     while (match(GREATER, GREATER_EQUAL, LESS, LESS_EQUAL)) {
       Token op = previous();
-      std::shared_ptr<Expr> right = term();
-      expr = std::make_shared<Binary>(expr, std::move(op), right);
+      Expr* right = term();
+      expr = arena.make<Binary>(expr, op, right);
     }
 
     return expr;
   }
 
-  std::shared_ptr<Expr> term() {
-    std::shared_ptr<Expr> expr = factor();
+  Expr* term() {
+    Expr* expr = factor();
 
     while (match(MINUS, PLUS)) {
       Token op = previous();
-      std::shared_ptr<Expr> right = factor();
-      expr = std::make_shared<Binary>(expr, std::move(op), right);
+      Expr* right = factor();
+      expr = arena.make<Binary>(expr, op, right);
     }
 
     return expr;
   }
 
-  std::shared_ptr<Expr> factor() {
-    std::shared_ptr<Expr> expr = unary();
+  Expr* factor() {
+    Expr* expr = unary();
 
     while (match(SLASH, STAR)) {
       Token op = previous();
-      std::shared_ptr<Expr> right = unary();
-      expr = std::make_shared<Binary>(expr, std::move(op), right);
+      Expr* right = unary();
+      expr = arena.make<Binary>(expr, op, right);
     }
 
     return expr;
   }
 
-  std::shared_ptr<Expr> unary() {
+  Expr* unary() {
     if (match(BANG, MINUS)) {
       Token op = previous();
-      std::shared_ptr<Expr> right = unary();
-      return std::make_shared<Unary>(std::move(op), right);
+      Expr* right = unary();
+      return arena.make<Unary>(op, right);
     }
 
     return call();
   }
 
-  std::shared_ptr<Expr> finishCall(std::shared_ptr<Expr> callee) {
-    std::vector<std::shared_ptr<Expr>> arguments;
+  Expr* finishCall(Expr* callee) {
+    std::vector<Expr*> arguments;
     if (!check(RIGHT_PAREN)) {
       do {
         if (arguments.size() >= 255) {
@@ -340,13 +354,13 @@ private:
     Token paren = consume(RIGHT_PAREN,
                           "Expect ')' after arguments.");
 
-    return std::make_shared<Call>(callee,
-                                  std::move(paren),
-                                  std::move(arguments));
+    return arena.make<Call>(callee,
+                            paren,
+                            std::move(arguments));
   }
 
-  std::shared_ptr<Expr> call() {
-    std::shared_ptr<Expr> expr = primary();
+  Expr* call() {
+    Expr* expr = primary();
 
     while (true) {
       if (match(LEFT_PAREN)) {
@@ -354,7 +368,7 @@ private:
       } else if (match(DOT)) {
         Token name = consume(IDENTIFIER,
             "Expect property name after '.'.");
-        expr = std::make_shared<Get>(expr, std::move(name));
+        expr = arena.make<Get>(expr, name);
       } else {
         break;
       }
@@ -363,13 +377,13 @@ private:
     return expr;
   }
 
-  std::shared_ptr<Expr> primary() {
-    if (match(FALSE)) return std::make_shared<Literal>(false);
-    if (match(TRUE)) return std::make_shared<Literal>(true);
-    if (match(NIL)) return std::make_shared<Literal>(nullptr);
+  Expr* primary() {
+    if (match(FALSE)) return arena.make<Literal>(false);
+    if (match(TRUE)) return arena.make<Literal>(true);
+    if (match(NIL)) return arena.make<Literal>(nullptr);
 
     if (match(NUMBER, STRING)) {
-      return std::make_shared<Literal>(previous().literal);
+      return arena.make<Literal>(previous().literal);
     }
 
     if (match(SUPER)) {
@@ -377,20 +391,20 @@ private:
       consume(DOT, "Expect '.' after 'super'.");
       Token method = consume(IDENTIFIER,
           "Expect superclass method name.");
-      return std::make_shared<Super>(std::move(keyword),
-                                     std::move(method));
+      return arena.make<Super>(keyword,
+                               method);
     }
 
-    if (match(THIS)) return std::make_shared<This>(previous());
+    if (match(THIS)) return arena.make<This>(previous());
 
     if (match(IDENTIFIER)) {
-      return std::make_shared<Variable>(previous());
+      return arena.make<Variable>(previous());
     }
 
     if (match(LEFT_PAREN)) {
-      std::shared_ptr<Expr> expr = expression();
+      Expr* expr = expression();
       consume(RIGHT_PAREN, "Expect ')' after expression.");
-      return std::make_shared<Grouping>(expr);
+      return arena.make<Grouping>(expr);
     }
 
     throw error(peek(), "Expect expression.");
@@ -408,7 +422,7 @@ private:
     return false;
   }
 
-  Token consume(TokenType type, std::string_view message) {
+  const Token& consume(TokenType type, std::string_view message) {
     if (check(type)) return advance();
 
     throw error(peek(), message);
@@ -419,8 +433,13 @@ private:
     return peek().type == type;
   }
 
-  Token advance() {
-    if (!isAtEnd()) ++current;
+  // The token that was the one before the previous is replaced by
+  // the next one.
+  const Token& advance() {
+    if (!isAtEnd()) {
+      ++current;
+      tokens[current % 2].emplace(scanner.nextToken());
+    }
     return previous();
   }
 
@@ -428,12 +447,15 @@ private:
     return peek().type == END_OF_FILE;
   }
 
-  Token peek() {
-    return tokens.at(current);
+  const Token& peek() {
+    return *tokens[current % 2];
   }
 
-  Token previous() {
-    return tokens.at(current - 1);
+  // Only called once a token has been consumed. The other slot holds
+  // the previous token for every current from 1 on.
+  const Token& previous() {
+    assert(current > 0);
+    return *tokens[(current + 1) % 2];
   }
 
   ParseError error(const Token& token, std::string_view message) {
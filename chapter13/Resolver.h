@@ -3,12 +3,23 @@
 #include <functional> // less
 #include <map>
 #include <memory>
+#include <string_view>
 #include <vector>
-#include "Interpreter.h"
+#include "Error.h"
+#include "Expr.h"
+#include "Stmt.h"
+#include "Token.h"
+
+class Resolver: public ExprVisitor<void>, public StmtVisitor<void> {
+  // A local's slot is its position among the variables declared in
+  // the same scope, which is also where the interpreter will store
+  // it in that scope's environment.
+  struct Local {
+    int slot;
+    bool defined;
+  };
 
-class Resolver: public ExprVisitor, public StmtVisitor {
-  Interpreter& interpreter;
-  std::vector<std::map<std::string, bool>> scopes;
+  std::vector<std::map<std::string_view, Local>> scopes;
 
   enum class FunctionType {
     NONE,
@@ -19,12 +30,6 @@ class Resolver: public ExprVisitor, public StmtVisitor {
 
   FunctionType currentFunction = FunctionType::NONE;
 
-public:
-  Resolver(Interpreter& interpreter)
-    : interpreter{interpreter}
-  {}
-
-private:
   enum class ClassType {
     NONE,
     CLASS,
@@ -34,20 +39,19 @@ private:
   ClassType currentClass = ClassType::NONE;
 
 public:
-  void resolve(const std::vector<std::shared_ptr<Stmt>>& statements) {
-    for (const std::shared_ptr<Stmt>& statement : statements) {
+  void resolve(const std::vector<Stmt*>& statements) {
+    for (Stmt* statement : statements) {
       resolve(statement);
     }
   }
 
-  std::any visitBlockStmt(std::shared_ptr<Block> stmt) override {
+  void visitBlockStmt(Block* stmt) override {
     beginScope();
     resolve(stmt->statements);
     endScope();
-    return {};
   }
 
-  std::any visitClassStmt(std::shared_ptr<Class> stmt) override {
+  void visitClassStmt(Class* stmt) override {
     ClassType enclosingClass = currentClass;
     currentClass = ClassType::CLASS;
 
@@ -67,13 +71,10 @@ public:
 
     if (stmt->superclass != nullptr) {
       beginScope();
-      scopes.back()["super"] = true;
+      scopes.back()["super"] = Local{0, true};
     }
 
-    beginScope();
-    scopes.back()["this"] = true;
-
-    for (std::shared_ptr<Function> method : stmt->methods) {
+    for (Function* method : stmt->methods) {
       FunctionType declaration = FunctionType::METHOD;
       if (method->name.lexeme == "init") {
         declaration = FunctionType::INITIALIZER;
@@ -82,42 +83,33 @@ public:
       resolveFunction(method, declaration);
     }
 
-    endScope();
-
     if (stmt->superclass != nullptr) endScope();
 
     currentClass = enclosingClass;
-    return {};
   }
 
-  std::any visitExpressionStmt(
-      std::shared_ptr<Expression> stmt) override {
+  void visitExpressionStmt(Expression* stmt) override {
     resolve(stmt->expression);
-    return {};
   }
 
-  std::any visitFunctionStmt(
-      std::shared_ptr<Function> stmt) override {
+  void visitFunctionStmt(Function* stmt) override {
     declare(stmt->name);
     define(stmt->name);
 
     resolveFunction(stmt, FunctionType::FUNCTION);
-    return {};
   }
 
-  std::any visitIfStmt(std::shared_ptr<If> stmt) override {
+  void visitIfStmt(If* stmt) override {
     resolve(stmt->condition);
     resolve(stmt->thenBranch);
     if (stmt->elseBranch != nullptr) resolve(stmt->elseBranch);
-    return {};
   }
 
-  std::any visitPrintStmt(std::shared_ptr<Print> stmt) override {
+  void visitPrintStmt(Print* stmt) override {
     resolve(stmt->expression);
-    return {};
   }
 
-  std::any visitReturnStmt(std::shared_ptr<Return> stmt) override {
+  void visitReturnStmt(Return* stmt) override {
     if (currentFunction == FunctionType::NONE) {
       error(stmt->keyword, "Can't return from top-level code.");
     }
@@ -129,76 +121,62 @@ public:
       }
 
       resolve(stmt->value);
+      markTailCall(stmt->value);
     }
-
-    return {};
   }
 
-  std::any visitVarStmt(std::shared_ptr<Var> stmt) override {
+  void visitVarStmt(Var* stmt) override {
     declare(stmt->name);
     if (stmt->initializer != nullptr) {
       resolve(stmt->initializer);
     }
     define(stmt->name);
-    return {};
   }
 
-  std::any visitWhileStmt(std::shared_ptr<While> stmt) override {
+  void visitWhileStmt(While* stmt) override {
     resolve(stmt->condition);
     resolve(stmt->body);
-    return {};
   }
 
-  std::any visitAssignExpr(std::shared_ptr<Assign> expr) override {
+  void visitAssignExpr(Assign* expr) override {
     resolve(expr->value);
     resolveLocal(expr, expr->name);
-    return {};
   }
 
-  std::any visitBinaryExpr(std::shared_ptr<Binary> expr) override {
+  void visitBinaryExpr(Binary* expr) override {
     resolve(expr->left);
     resolve(expr->right);
-    return {};
   }
 
-  std::any visitCallExpr(std::shared_ptr<Call> expr) override {
+  void visitCallExpr(Call* expr) override {
     resolve(expr->callee);
 
-    for (const std::shared_ptr<Expr>& argument : expr->arguments) {
+    for (Expr* argument : expr->arguments) {
       resolve(argument);
     }
-
-    return {};
   }
 
-  std::any visitGetExpr(std::shared_ptr<Get> expr) override {
+  void visitGetExpr(Get* expr) override {
     resolve(expr->object);
-    return {};
   }
 
-  std::any visitGroupingExpr(
-      std::shared_ptr<Grouping> expr) override {
+  void visitGroupingExpr(Grouping* expr) override {
     resolve(expr->expression);
-    return {};
   }
 
-  std::any visitLiteralExpr(std::shared_ptr<Literal> expr) override {
-    return {};
-  }
+  void visitLiteralExpr(Literal* expr) override {}
 
-  std::any visitLogicalExpr(std::shared_ptr<Logical> expr) override {
+  void visitLogicalExpr(Logical* expr) override {
     resolve(expr->left);
     resolve(expr->right);
-    return {};
   }
 
-  std::any visitSetExpr(std::shared_ptr<Set> expr) override {
+  void visitSetExpr(Set* expr) override {
     resolve(expr->value);
     resolve(expr->object);
-    return {};
   }
 
-  std::any visitSuperExpr(std::shared_ptr<Super> expr) override {
+  void visitSuperExpr(Super* expr) override {
     if (currentClass == ClassType::NONE) {
       error(expr->keyword,
           "Can't user 'super' outside of a class.");
@@ -208,66 +186,84 @@ public:
     }
 
     resolveLocal(expr, expr->keyword);
-    return {};
   }
 
-  std::any visitThisExpr(std::shared_ptr<This> expr) override {
+  void visitThisExpr(This* expr) override {
     if (currentClass == ClassType::NONE) {
       error(expr->keyword,
           "Can't use 'this' outside of a class.");
-      return {};
+      return;
     }
 
     resolveLocal(expr, expr->keyword);
-    return {};
   }
 
-  std::any visitUnaryExpr(std::shared_ptr<Unary> expr) override {
+  void visitUnaryExpr(Unary* expr) override {
     resolve(expr->right);
-    return {};
   }
 
-  std::any visitVariableExpr(
-      std::shared_ptr<Variable> expr) override {
+  void visitVariableExpr(Variable* expr) override {
     if (!scopes.empty()) {
       auto& scope = scopes.back();
       auto elem = scope.find(expr->name.lexeme);
-      if (elem != scope.end() && elem->second == false) {
+      if (elem != scope.end() && !elem->second.defined) {
         error(expr->name,
             "Can't read local variable in its own initializer.");
       }
     }
 
     resolveLocal(expr, expr->name);
-    return {};
   }
 
 private:
-  void resolve(std::shared_ptr<Stmt> stmt) {
+  void resolve(Stmt* stmt) {
     stmt->accept(*this);
   }
 
-  void resolve(std::shared_ptr<Expr> expr) {
+  void resolve(Expr* expr) {
     expr->accept(*this);
   }
 
-  void resolveFunction(
-      std::shared_ptr<Function> function, FunctionType type) {
+  void resolveFunction(Function* function, FunctionType type) {
     FunctionType enclosingFunction = currentFunction;
     currentFunction = type;
 
     beginScope();
+
+    // A method's instance is passed to it ahead of its parameters.
+    if (type == FunctionType::METHOD ||
+        type == FunctionType::INITIALIZER) {
+      scopes.back()["this"] = Local{0, true};
+    }
+
     for (const Token& param : function->params) {
       declare(param);
       define(param);
     }
     resolve(function->body);
+
+    // The parameters and the variables the body declares share the
+    // function's environment.
+    function->locals = scopes.back().size();
     endScope();
     currentFunction = enclosingFunction;
   }
 
+  // A call whose result is returned as it is is the last thing its
+  // function does, so the engines can make it in place of the
+  // function's own frame rather than on top of it.
+  void markTailCall(Expr* value) {
+    while (value->type == ExprType::GROUPING) {
+      value = static_cast<Grouping*>(value)->expression;
+    }
+
+    if (value->type == ExprType::CALL) {
+      static_cast<Call*>(value)->tail = true;
+    }
+  }
+
   void beginScope() {
-    scopes.push_back(std::map<std::string, bool>{});
+    scopes.push_back(std::map<std::string_view, Local>{});
   }
 
   void endScope() {
@@ -277,24 +273,31 @@ private:
   void declare(const Token& name) {
     if (scopes.empty()) return;
 
-    std::map<std::string, bool>& scope = scopes.back();
+    std::map<std::string_view, Local>& scope = scopes.back();
     if (scope.find(name.lexeme) != scope.end()) {
       error(name,
           "Already a variable with this name in this scope.");
     }
 
-    scope[name.lexeme] = false;
+    int slot = scope.size();
+    scope[name.lexeme] = Local{slot, false};
   }
 
   void define(const Token& name) {
     if (scopes.empty()) return;
-    scopes.back()[name.lexeme] = true;
+    scopes.back()[name.lexeme].defined = true;
   }
 
-  void resolveLocal(std::shared_ptr<Expr> expr, const Token& name) {
+  // The resolution is stored right on the node, which is one of
+  // Assign, Super, This or Variable. Names that aren't found keep a
+  // depth of -1 and are left for the interpreter to treat as globals.
+  template <class E>
+  void resolveLocal(E* expr, const Token& name) {
     for (int i = scopes.size() - 1; i >= 0; --i) {
-      if (scopes[i].find(name.lexeme) != scopes[i].end()) {
-        interpreter.resolve(expr, scopes.size() - 1 - i);
+      auto elem = scopes[i].find(name.lexeme);
+      if (elem != scopes[i].end()) {
+        expr->depth = scopes.size() - 1 - i;
+        expr->slot = elem->second.slot;
         return;
       }
     }
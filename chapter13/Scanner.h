@@ -1,18 +1,26 @@
 #pragma once
 
-#include <map>
+#include <cstddef>      // std::size_t
+#include <optional>
 #include <string>
 #include <string_view>
+#include <unordered_map>
 #include <utility>      // std::move
 #include <vector>
 #include "Error.h"
+#include "Number.h"
+#include "Simd.h"
 #include "Token.h"
 
 class Scanner {
-  static const std::map<std::string, TokenType> keywords;
-
   std::string_view source;
-  std::vector<Token> tokens;
+
+  // The token the last lexeme made, if it made one.
+  std::optional<Token> token;
+
+  // String literals with the same text share one value.
+  std::unordered_map<std::string_view, Value> strings;
+
   int start = 0;
   int current = 0;
   int line = 1;
@@ -22,17 +30,73 @@ public:
     : source {source}
   {}
 
-  std::vector<Token> scanTokens() {
-    while (!isAtEnd()) {
+  // Tokens are scanned one at a time, as the parser asks for them.
+  // Once the source runs out, every call returns END_OF_FILE.
+  Token nextToken() {
+    while (!token && !isAtEnd()) {
       // We are at the beginning of the next lexeme.
       start = current;
       scanToken();
     }
 
-    tokens.emplace_back(END_OF_FILE, "", nullptr, line);
+    // The end of the file is located just past the last character.
+    if (!token) {
+      return Token{END_OF_FILE, source.substr(source.length()), nullptr,
+                   line};
+    }
+
+    Token next = *token;
+    token.reset();
+    return next;
+  }
+
+  std::vector<Token> scanTokens() {
+    std::vector<Token> tokens;
+    do {
+      tokens.push_back(nextToken());
+    } while (tokens.back().type != END_OF_FILE);
+
     return tokens;
   }
 
+  // Tells keywords from other identifiers without a table: a switch
+  // on the first letter or two narrows the identifier down to the one
+  // keyword it could be, and the rest of it is compared to that.
+  static constexpr TokenType keyword(std::string_view text) {
+    switch (text[0]) {
+      case 'a': return checkKeyword(text, 1, "nd", AND);
+      case 'c': return checkKeyword(text, 1, "lass", CLASS);
+      case 'e': return checkKeyword(text, 1, "lse", ELSE);
+      case 'f':
+        if (text.length() > 1) {
+          switch (text[1]) {
+            case 'a': return checkKeyword(text, 2, "lse", FALSE);
+            case 'o': return checkKeyword(text, 2, "r", FOR);
+            case 'u': return checkKeyword(text, 2, "n", FUN);
+          }
+        }
+        break;
+      case 'i': return checkKeyword(text, 1, "f", IF);
+      case 'n': return checkKeyword(text, 1, "il", NIL);
+      case 'o': return checkKeyword(text, 1, "r", OR);
+      case 'p': return checkKeyword(text, 1, "rint", PRINT);
+      case 'r': return checkKeyword(text, 1, "eturn", RETURN);
+      case 's': return checkKeyword(text, 1, "uper", SUPER);
+      case 't':
+        if (text.length() > 1) {
+          switch (text[1]) {
+            case 'h': return checkKeyword(text, 2, "is", THIS);
+            case 'r': return checkKeyword(text, 2, "ue", TRUE);
+          }
+        }
+        break;
+      case 'v': return checkKeyword(text, 1, "ar", VAR);
+      case 'w': return checkKeyword(text, 1, "hile", WHILE);
+    }
+
+    return IDENTIFIER;
+  }
+
 private:
   void scanToken() {
     char c = advance();
@@ -63,7 +127,7 @@ private:
       case '/':
         if (match('/')) {
           // A comment goes until the end of the line.
-          while (peek() != '\n' && !isAtEnd()) advance();
+          skipTo(simd::findNewline(at(current), end()));
         } else {
           addToken(SLASH);
         }
@@ -72,11 +136,9 @@ private:
       case ' ':
       case '\r':
       case '\t':
-        // Ignore whitespace.
-        break;
-
       case '\n':
-        ++line;
+        // Ignore whitespace, all of it at once.
+        skipTo(simd::skipWhitespace(at(start), end(), line));
         break;
 
       case '"': string(); break;
@@ -89,55 +151,47 @@ private:
         } else if (isAlpha(c)) {
           identifier();
         } else {
-          error(line, "Unexpected character.");
+          error(line, at(start), "Unexpected character.");
         }
         break;
       };
   }
 
   void identifier() {
-    while (isAlphaNumeric(peek())) advance();
+    skipTo(simd::skipIdentifier(at(current), end()));
 
     // addToken(IDENTIFIER);
 
-    std::string text =
-        std::string{source.substr(start, current - start)};
-
-    TokenType type;
-    auto match = keywords.find(text);
-    if (match == keywords.end()) {
-      type = IDENTIFIER;
-    } else {
-      type = match->second;
-    }
+    addToken(keyword(source.substr(start, current - start)));
+  }
 
-    addToken(type);
+  static constexpr TokenType checkKeyword(std::string_view text,
+                                          std::size_t start,
+                                          std::string_view rest,
+                                          TokenType type) {
+    return text.substr(start) == rest ? type : IDENTIFIER;
   }
 
   void number() {
-    while (isDigit(peek())) advance();
+    skipTo(simd::skipDigits(at(current), end()));
 
     // Look for a fractional part.
     if (peek() == '.' && isDigit(peekNext())) {
       // Consume the "."
       advance();
 
-      while (isDigit(peek())) advance();
+      skipTo(simd::skipDigits(at(current), end()));
     }
 
     addToken(NUMBER,
-        std::stod(std::string{
-            source.substr(start, current - start)}));
+        parseNumber(source.substr(start, current - start)));
   }
 
   void string() {
-    while (peek() != '"' && !isAtEnd()) {
-      if (peek() == '\n') ++line;
-      advance();
-    }
+    skipTo(simd::findQuote(at(current), end(), line));
 
     if (isAtEnd()) {
-      error(line, "Unterminated string.");
+      error(line, at(start), "Unterminated string.");
       return;
     }
 
@@ -145,7 +199,10 @@ private:
     advance();
 
     // Trim the surrounding quotes.
-    std::string value{source.substr(start + 1, current - 2 - start)};
+    std::string_view text =
+        source.substr(start + 1, current - 2 - start);
+    Value& value = strings[text];
+    if (value.isNil()) value = std::string{text};
     addToken(STRING, value);
   }
 
@@ -173,10 +230,6 @@ private:
             c == '_';
   }
 
-  bool isAlphaNumeric(char c) {
-    return isAlpha(c) || isDigit(c);
-  }
-
   bool isDigit(char c) {
     return c >= '0' && c <= '9';
   }
@@ -189,33 +242,49 @@ private:
     return source[current++];
   }
 
+  // The runs of characters a token is made of, or the whitespace and
+  // comments between tokens, are found many characters at a time.
+  const char* at(int position) {
+    return source.data() + position;
+  }
+
+  const char* end() {
+    return source.data() + source.length();
+  }
+
+  void skipTo(const char* position) {
+    current = position - source.data();
+  }
+
   void addToken(TokenType type) {
     addToken(type, nullptr);
   }
 
-  void addToken(TokenType type, std::any literal) {
-    std::string text{source.substr(start, current - start)};
-    tokens.emplace_back(type, std::move(text), std::move(literal),
-                        line);
+  void addToken(TokenType type, Value literal) {
+    token.emplace(type, source.substr(start, current - start),
+                  std::move(literal), line);
   }
 };
 
-const std::map<std::string, TokenType> Scanner::keywords =
-{
-  {"and",    TokenType::AND},
-  {"class",  TokenType::CLASS},
-  {"else",   TokenType::ELSE},
-  {"false",  TokenType::FALSE},
-  {"for",    TokenType::FOR},
-  {"fun",    TokenType::FUN},
-  {"if",     TokenType::IF},
-  {"nil",    TokenType::NIL},
-  {"or",     TokenType::OR},
-  {"print",  TokenType::PRINT},
-  {"return", TokenType::RETURN},
-  {"super",  TokenType::SUPER},
-  {"this",   TokenType::THIS},
-  {"true",   TokenType::TRUE},
-  {"var",    TokenType::VAR},
-  {"while",  TokenType::WHILE},
-};
+// The keywords, checked as jlox is compiled.
+static_assert(Scanner::keyword("and")    == TokenType::AND);
+static_assert(Scanner::keyword("class")  == TokenType::CLASS);
+static_assert(Scanner::keyword("else")   == TokenType::ELSE);
+static_assert(Scanner::keyword("false")  == TokenType::FALSE);
+static_assert(Scanner::keyword("for")    == TokenType::FOR);
+static_assert(Scanner::keyword("fun")    == TokenType::FUN);
+static_assert(Scanner::keyword("if")     == TokenType::IF);
+static_assert(Scanner::keyword("nil")    == TokenType::NIL);
+static_assert(Scanner::keyword("or")     == TokenType::OR);
+static_assert(Scanner::keyword("print")  == TokenType::PRINT);
+static_assert(Scanner::keyword("return") == TokenType::RETURN);
+static_assert(Scanner::keyword("super")  == TokenType::SUPER);
+static_assert(Scanner::keyword("this")   == TokenType::THIS);
+static_assert(Scanner::keyword("true")   == TokenType::TRUE);
+static_assert(Scanner::keyword("var")    == TokenType::VAR);
+static_assert(Scanner::keyword("while")  == TokenType::WHILE);
+
+static_assert(Scanner::keyword("an")     == TokenType::IDENTIFIER);
+static_assert(Scanner::keyword("f")      == TokenType::IDENTIFIER);
+static_assert(Scanner::keyword("fort")   == TokenType::IDENTIFIER);
+static_assert(Scanner::keyword("th")     == TokenType::IDENTIFIER);
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>      // std::move
+
+class LoxFunction;
+
+// The layout of an instance's fields, shared by every instance that
+// was given the same fields in the same order. A shape maps each
+// field name to a slot in the instance's array of values. Adding a
+// field moves an instance to the next shape along, and that
+// transition is remembered so instances built the same way end up
+// sharing their shapes.
+//
+// Every class has its own empty shape to start from, so a shape also
+// identifies the class of the instances that have it.
+class Shape {
+  std::unordered_map<std::string, int> slots;
+  std::unordered_map<std::string, std::shared_ptr<Shape>> transitions;
+
+public:
+  // Returns -1 if there is no such field.
+  int find(std::string_view name) const {
+    auto elem = slots.find(std::string{name});
+    if (elem == slots.end()) return -1;
+    return elem->second;
+  }
+
+  // The shape with one more field, in the next slot.
+  const std::shared_ptr<Shape>& add(std::string_view name) {
+    std::shared_ptr<Shape>& next = transitions[std::string{name}];
+
+    if (next == nullptr) {
+      next = std::make_shared<Shape>();
+      next->slots = slots;
+      next->slots.emplace(name, static_cast<int>(slots.size()));
+    }
+
+    return next;
+  }
+};
+
+// An inline cache on a property access, holding what the last lookup
+// at that site found. As long as the next instance has the same shape,
+// the field is in the same slot, or the method is the same, and no
+// names need to be compared.
+//
+// The cache keeps its shape alive, so another shape can never be
+// mistaken for it by turning up at the same address. It doesn't keep
+// the method alive, since the AST the cache is in lives as long as the
+// program does, and the method's closure with it. The class of any
+// instance with the cache's shape holds the method anyway.
+struct PropertyCache {
+  std::shared_ptr<Shape> shape;
+  int slot = -1;
+
+  // Set instead of the slot when the property is a method, which no
+  // instance of the same shape can have a field in front of.
+  std::weak_ptr<LoxFunction> method;
+
+  // For a store that added the field, the shape the instance moved to.
+  std::shared_ptr<Shape> next;
+
+  static PropertyCache forField(std::shared_ptr<Shape> shape,
+                                int slot) {
+    PropertyCache cache;
+    cache.shape = std::move(shape);
+    cache.slot = slot;
+    return cache;
+  }
+
+  static PropertyCache forMethod(std::shared_ptr<Shape> shape,
+                                 std::weak_ptr<LoxFunction> method) {
+    PropertyCache cache;
+    cache.shape = std::move(shape);
+    cache.method = std::move(method);
+    return cache;
+  }
+
+  // A store that added a field in the given slot.
+  static PropertyCache forTransition(std::shared_ptr<Shape> shape,
+                                     int slot,
+                                     std::shared_ptr<Shape> next) {
+    PropertyCache cache = forField(std::move(shape), slot);
+    cache.next = std::move(next);
+    return cache;
+  }
+};
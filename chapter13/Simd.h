@@ -0,0 +1,184 @@
+#pragma once
+
+#include <cstdint>      // std::uint32_t
+
+// SSE2 is part of every x86-64 processor, so it needs no check at
+// runtime. Everywhere else the scanner looks at one character at a
+// time.
+#if defined(__SSE2__) && (defined(__GNUC__) || defined(__clang__))
+#define JLOX_SSE2
+#include <emmintrin.h>
+#endif
+
+// The runs of characters the scanner skips over: whitespace between
+// tokens, the rest of a comment, the rest of a name or a number, and
+// the inside of a string. Each function below returns the first
+// character at or after from, before end, that ends the run, or end if
+// nothing does. The ones that can pass newlines add them to line.
+//
+// Blocks of 16 characters are compared at once, which gives a bit for
+// each of them, and the first bit that is set is where the run ends.
+// The last few characters of the source, too few for a block, are
+// looked at one at a time.
+namespace simd {
+
+inline bool isWhitespace(char c) {
+  return c == ' ' || c == '\r' || c == '\t' || c == '\n';
+}
+
+inline bool isIdentifier(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') || c == '_';
+}
+
+inline bool isDigit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+#ifdef JLOX_SSE2
+constexpr int BLOCK = 16;
+
+inline __m128i load(const char* from) {
+  return _mm_loadu_si128(reinterpret_cast<const __m128i*>(from));
+}
+
+inline std::uint32_t bits(__m128i matches) {
+  return static_cast<std::uint32_t>(_mm_movemask_epi8(matches));
+}
+
+// The bits of the characters that don't match.
+inline std::uint32_t others(__m128i matches) {
+  return ~bits(matches) & 0xFFFF;
+}
+
+inline __m128i equal(__m128i block, char c) {
+  return _mm_cmpeq_epi8(block, _mm_set1_epi8(c));
+}
+
+// Characters above 127 compare as negative, so they are never in the
+// range.
+inline __m128i inRange(__m128i block, char low, char high) {
+  return _mm_and_si128(_mm_cmpgt_epi8(block, _mm_set1_epi8(low - 1)),
+                       _mm_cmplt_epi8(block, _mm_set1_epi8(high + 1)));
+}
+
+// Returns the first character that ends the run, or where the blocks
+// ran out, in which case found is cleared. The newlines before it are
+// added to line.
+template <class End>
+const char* findBlock(const char* from, const char* end, int& line,
+                      bool& found, End ends) {
+  while (end - from >= BLOCK) {
+    std::uint32_t newlines;
+    std::uint32_t matches = ends(load(from), newlines);
+    if (matches != 0) {
+      int offset = __builtin_ctz(matches);
+      line += __builtin_popcount(newlines & ((1u << offset) - 1));
+      found = true;
+      return from + offset;
+    }
+
+    line += __builtin_popcount(newlines);
+    from += BLOCK;
+  }
+
+  found = false;
+  return from;
+}
+
+// For runs that can't contain newlines.
+template <class End>
+const char* findBlock(const char* from, const char* end, End ends) {
+  int line = 0;
+  bool found;
+  return findBlock(from, end, line, found,
+      [ends](__m128i block, std::uint32_t& newlines) {
+        newlines = 0;
+        return ends(block);
+      });
+}
+#endif
+
+// Tokens are mostly separated by a single space or a newline, so the
+// blocks are only compared once there is more whitespace than that.
+inline const char* skipWhitespace(const char* from, const char* end,
+                                  int& line) {
+  if (*from == '\n') ++line;
+  if (++from == end || !isWhitespace(*from)) return from;
+
+#ifdef JLOX_SSE2
+  bool found;
+  from = findBlock(from, end, line, found,
+      [](__m128i block, std::uint32_t& newlines) {
+        __m128i newline = equal(block, '\n');
+        newlines = bits(newline);
+        return others(_mm_or_si128(
+            _mm_or_si128(equal(block, ' '), newline),
+            _mm_or_si128(equal(block, '\t'), equal(block, '\r'))));
+      });
+  if (found) return from;
+#endif
+
+  for (; from != end && isWhitespace(*from); ++from) {
+    if (*from == '\n') ++line;
+  }
+  return from;
+}
+
+inline const char* skipIdentifier(const char* from, const char* end) {
+#ifdef JLOX_SSE2
+  // Setting the 0x20 bit turns upper case letters into lower case.
+  from = findBlock(from, end, [](__m128i block) {
+    __m128i lower = _mm_or_si128(block, _mm_set1_epi8(0x20));
+    return others(_mm_or_si128(
+        _mm_or_si128(inRange(lower, 'a', 'z'),
+                     inRange(block, '0', '9')),
+        equal(block, '_')));
+  });
+#endif
+
+  while (from != end && isIdentifier(*from)) ++from;
+  return from;
+}
+
+inline const char* skipDigits(const char* from, const char* end) {
+#ifdef JLOX_SSE2
+  from = findBlock(from, end, [](__m128i block) {
+    return others(inRange(block, '0', '9'));
+  });
+#endif
+
+  while (from != end && isDigit(*from)) ++from;
+  return from;
+}
+
+inline const char* findNewline(const char* from, const char* end) {
+#ifdef JLOX_SSE2
+  from = findBlock(from, end, [](__m128i block) {
+    return bits(equal(block, '\n'));
+  });
+#endif
+
+  while (from != end && *from != '\n') ++from;
+  return from;
+}
+
+inline const char* findQuote(const char* from, const char* end,
+                             int& line) {
+#ifdef JLOX_SSE2
+  bool found;
+  from = findBlock(from, end, line, found,
+      [](__m128i block, std::uint32_t& newlines) {
+        newlines = bits(equal(block, '\n'));
+        return bits(equal(block, '"'));
+      });
+  if (found) return from;
+#endif
+
+  for (; from != end && *from != '"'; ++from) {
+    if (*from == '\n') ++line;
+  }
+  return from;
+}
+
+} // namespace simd
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <algorithm>    // std::upper_bound
+#include <cerrno>
+#include <cstddef>      // std::size_t
+#include <fstream>
+#include <iterator>     // std::istreambuf_iterator
+#include <memory>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>      // std::move
+#include <vector>
+
+// Files are mapped into memory through POSIX. Everywhere else, and for
+// anything that can't be mapped, like a pipe, they are read.
+#if defined(__linux__) || defined(__APPLE__)
+#define JLOX_MMAP
+#include <fcntl.h>      // open
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>     // close
+#endif
+
+// Owns the source of every script and REPL line that was compiled.
+// Tokens, and through them the AST, point straight into the source,
+// so it stays where it is for as long as the program runs. A file is
+// mapped read-only rather than read, which means its pages are only
+// loaded as the scanner gets to them and nothing is copied.
+class SourceManager {
+public:
+  struct Location {
+    int line;
+    int column;
+  };
+
+private:
+  struct Source {
+    std::string_view text;
+
+    // Only used when the source isn't mapped.
+    std::string contents;
+
+#ifdef JLOX_MMAP
+    void* mapping = nullptr;
+#endif
+
+    // Where each line starts, found the first time a position in the
+    // source is located.
+    std::vector<std::size_t> lines;
+
+    Source() = default;
+    Source(const Source&) = delete;
+    Source& operator=(const Source&) = delete;
+
+    ~Source() {
+#ifdef JLOX_MMAP
+      if (mapping != nullptr) {
+        munmap(mapping, text.length());
+      }
+#endif
+    }
+  };
+
+  std::vector<std::unique_ptr<Source>> sources;
+
+public:
+  // Throws std::system_error if the file can't be read.
+  std::string_view load(const std::string& path) {
+    auto source = std::make_unique<Source>();
+
+#ifdef JLOX_MMAP
+    int file = open(path.c_str(), O_RDONLY);
+    if (file < 0) fail();
+
+    struct stat status;
+    if (fstat(file, &status) == 0 && S_ISREG(status.st_mode) &&
+        status.st_size > 0) {
+      void* mapping = mmap(nullptr, status.st_size, PROT_READ,
+                           MAP_PRIVATE, file, 0);
+      if (mapping != MAP_FAILED) {
+        // The scanner reads the source once, from start to end.
+        madvise(mapping, status.st_size, MADV_SEQUENTIAL);
+        source->mapping = mapping;
+        source->text = std::string_view{
+            static_cast<const char*>(mapping),
+            static_cast<std::size_t>(status.st_size)};
+      }
+    }
+
+    close(file);
+    if (source->mapping != nullptr) return keep(std::move(source));
+#endif
+
+    std::ifstream stream{path, std::ios::in | std::ios::binary};
+    if (!stream) fail();
+
+    source->contents.assign(std::istreambuf_iterator<char>{stream},
+                            std::istreambuf_iterator<char>{});
+    source->text = source->contents;
+    return keep(std::move(source));
+  }
+
+  // Source that didn't come from a file, like a line of the REPL.
+  std::string_view add(std::string text) {
+    auto source = std::make_unique<Source>();
+    source->contents = std::move(text);
+    source->text = source->contents;
+    return keep(std::move(source));
+  }
+
+  // Finds the line and column, both counted from 1, of a character in
+  // any of the sources, such as the start of a token's lexeme.
+  Location locate(const char* position) {
+    for (const std::unique_ptr<Source>& source : sources) {
+      const char* start = source->text.data();
+      if (position < start ||
+          position > start + source->text.length()) {
+        continue;
+      }
+
+      std::vector<std::size_t>& lines = source->lines;
+      if (lines.empty()) {
+        lines.push_back(0);
+        for (std::size_t i = 0; i < source->text.length(); ++i) {
+          if (source->text[i] == '\n') lines.push_back(i + 1);
+        }
+      }
+
+      std::size_t offset = position - start;
+      auto next = std::upper_bound(lines.begin(), lines.end(), offset);
+      int line = next - lines.begin();
+      return Location{line, static_cast<int>(offset - next[-1]) + 1};
+    }
+
+    return Location{0, 0};
+  }
+
+private:
+  std::string_view keep(std::unique_ptr<Source> source) {
+    sources.push_back(std::move(source));
+    return sources.back()->text;
+  }
+
+  [[noreturn]] static void fail() {
+    throw std::system_error{errno, std::generic_category()};
+  }
+};
+
+// The tokens in the AST point into the source they were scanned from,
+// which is kept here. Errors are reported from it too.
+inline SourceManager sources;
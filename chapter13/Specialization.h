@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstdint>      // std::uint8_t
+
+// What a Binary, Unary or Logical node has learned about its operands.
+// A node starts out uninitialized, specializes itself to the operand
+// types it sees on its first evaluation, and falls back to the
+// generic form for good the first time those types change.
+enum class Specialization: std::uint8_t {
+  UNINITIALIZED,
+  GENERIC,
+  NUMBER,           // every operand has been a number
+  STRING,           // both operands of + or == have been strings
+  BOOL              // the operand of ! or a logical has been a bool
+};
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>      // std::size_t
+
+// Threads with a stack of a given size are created through POSIX.
+// Everywhere else the program runs on the stack it was given.
+#if defined(__linux__) || defined(__APPLE__)
+#define JLOX_LARGE_STACK
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>     // sysconf
+#endif
+
+// Each Lox call nests several calls in C++, so a program can only
+// recurse as deeply as the native stack allows. The few megabytes a
+// process starts with run out after some thousands of Lox calls, and
+// running out crashes the process.
+//
+// Runs body on a thread of its own with a stack of the given size.
+// The stack is only reserved, and the system provides its pages as
+// the stack grows into them, so it costs nothing until it's used. A
+// page below it that can't be accessed stops it from growing into
+// anything else. If no such thread can be created, body runs here.
+template <class F>
+void runOnStack(std::size_t size, F body) {
+#ifdef JLOX_LARGE_STACK
+  std::size_t page = sysconf(_SC_PAGESIZE);
+  size = (size + page - 1) / page * page;
+
+  void* memory = mmap(nullptr, page + size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                      -1, 0);
+
+  if (memory != MAP_FAILED) {
+    // The stack grows down, toward the guard page.
+    mprotect(memory, page, PROT_NONE);
+
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    void* stack = static_cast<char*>(memory) + page;
+    pthread_attr_setstack(&attributes, stack, size);
+
+    auto start = [](void* body) -> void* {
+      (*static_cast<F*>(body))();
+      return nullptr;
+    };
+
+    pthread_t thread;
+    int error = pthread_create(&thread, &attributes, start, &body);
+    pthread_attr_destroy(&attributes);
+
+    if (error == 0) pthread_join(thread, nullptr);
+    munmap(memory, page + size);
+    if (error == 0) return;
+  }
+#endif
+
+  body();
+}
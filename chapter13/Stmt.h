@@ -1,10 +1,9 @@
 #pragma once
 
-#include <any>
-#include <memory>
 #include <utility>  // std::move
 #include <vector>
 #include "Token.h"
+#include "Value.h"
 
 #include "Expr.h"
 
@@ -18,137 +17,150 @@ struct Return;
 struct Var;
 struct While;
 
+enum class StmtType {
+  BLOCK,
+  CLASS,
+  EXPRESSION,
+  FUNCTION,
+  IF,
+  PRINT,
+  RETURN,
+  VAR,
+  WHILE,
+};
+
+template <class R>
 struct StmtVisitor {
-  virtual std::any visitBlockStmt(std::shared_ptr<Block> stmt) = 0;
-  virtual std::any visitClassStmt(std::shared_ptr<Class> stmt) = 0;
-  virtual std::any visitExpressionStmt(std::shared_ptr<Expression> stmt) = 0;
-  virtual std::any visitFunctionStmt(std::shared_ptr<Function> stmt) = 0;
-  virtual std::any visitIfStmt(std::shared_ptr<If> stmt) = 0;
-  virtual std::any visitPrintStmt(std::shared_ptr<Print> stmt) = 0;
-  virtual std::any visitReturnStmt(std::shared_ptr<Return> stmt) = 0;
-  virtual std::any visitVarStmt(std::shared_ptr<Var> stmt) = 0;
-  virtual std::any visitWhileStmt(std::shared_ptr<While> stmt) = 0;
+  virtual R visitBlockStmt(Block* stmt) = 0;
+  virtual R visitClassStmt(Class* stmt) = 0;
+  virtual R visitExpressionStmt(Expression* stmt) = 0;
+  virtual R visitFunctionStmt(Function* stmt) = 0;
+  virtual R visitIfStmt(If* stmt) = 0;
+  virtual R visitPrintStmt(Print* stmt) = 0;
+  virtual R visitReturnStmt(Return* stmt) = 0;
+  virtual R visitVarStmt(Var* stmt) = 0;
+  virtual R visitWhileStmt(While* stmt) = 0;
   virtual ~StmtVisitor() = default;
 };
 
 struct Stmt {
-  virtual std::any accept(StmtVisitor& visitor) = 0;
-};
+  const StmtType type;
+
+  template <class R>
+  R accept(StmtVisitor<R>& visitor);
 
-struct Block: Stmt, public std::enable_shared_from_this<Block> {
-  Block(std::vector<std::shared_ptr<Stmt>> statements)
-    : statements{std::move(statements)}
+protected:
+  Stmt(StmtType type)
+    : type{type}
   {}
+};
 
-  std::any accept(StmtVisitor& visitor) override {
-    return visitor.visitBlockStmt(shared_from_this());
-  }
+struct Block: Stmt {
+  Block(std::vector<Stmt*> statements)
+    : Stmt{StmtType::BLOCK}, statements{std::move(statements)}
+  {}
 
-  const std::vector<std::shared_ptr<Stmt>> statements;
+  const std::vector<Stmt*> statements;
 };
 
-struct Class: Stmt, public std::enable_shared_from_this<Class> {
-  Class(Token name, std::shared_ptr<Variable> superclass, std::vector<std::shared_ptr<Function>> methods)
-    : name{std::move(name)}, superclass{std::move(superclass)}, methods{std::move(methods)}
+struct Class: Stmt {
+  Class(Token name, Variable* superclass, std::vector<Function*> methods)
+    : Stmt{StmtType::CLASS}, name{std::move(name)}, superclass{std::move(superclass)}, methods{std::move(methods)}
   {}
 
-  std::any accept(StmtVisitor& visitor) override {
-    return visitor.visitClassStmt(shared_from_this());
-  }
-
   const Token name;
-  const std::shared_ptr<Variable> superclass;
-  const std::vector<std::shared_ptr<Function>> methods;
+  Variable* const superclass;
+  const std::vector<Function*> methods;
 };
 
-struct Expression: Stmt, public std::enable_shared_from_this<Expression> {
-  Expression(std::shared_ptr<Expr> expression)
-    : expression{std::move(expression)}
+struct Expression: Stmt {
+  Expression(Expr* expression)
+    : Stmt{StmtType::EXPRESSION}, expression{std::move(expression)}
   {}
 
-  std::any accept(StmtVisitor& visitor) override {
-    return visitor.visitExpressionStmt(shared_from_this());
-  }
-
-  const std::shared_ptr<Expr> expression;
+  Expr* const expression;
 };
 
-struct Function: Stmt, public std::enable_shared_from_this<Function> {
-  Function(Token name, std::vector<Token> params, std::vector<std::shared_ptr<Stmt>> body)
-    : name{std::move(name)}, params{std::move(params)}, body{std::move(body)}
+struct Function: Stmt {
+  Function(Token name, std::vector<Token> params, std::vector<Stmt*> body)
+    : Stmt{StmtType::FUNCTION}, name{std::move(name)}, params{std::move(params)}, body{std::move(body)}
   {}
 
-  std::any accept(StmtVisitor& visitor) override {
-    return visitor.visitFunctionStmt(shared_from_this());
-  }
-
   const Token name;
   const std::vector<Token> params;
-  const std::vector<std::shared_ptr<Stmt>> body;
+  const std::vector<Stmt*> body;
+
+  int locals = 0;
 };
 
-struct If: Stmt, public std::enable_shared_from_this<If> {
-  If(std::shared_ptr<Expr> condition, std::shared_ptr<Stmt> thenBranch, std::shared_ptr<Stmt> elseBranch)
-    : condition{std::move(condition)}, thenBranch{std::move(thenBranch)}, elseBranch{std::move(elseBranch)}
+struct If: Stmt {
+  If(Expr* condition, Stmt* thenBranch, Stmt* elseBranch)
+    : Stmt{StmtType::IF}, condition{std::move(condition)}, thenBranch{std::move(thenBranch)}, elseBranch{std::move(elseBranch)}
   {}
 
-  std::any accept(StmtVisitor& visitor) override {
-    return visitor.visitIfStmt(shared_from_this());
-  }
-
-  const std::shared_ptr<Expr> condition;
-  const std::shared_ptr<Stmt> thenBranch;
-  const std::shared_ptr<Stmt> elseBranch;
+  Expr* const condition;
+  Stmt* const thenBranch;
+  Stmt* const elseBranch;
 };
 
-struct Print: Stmt, public std::enable_shared_from_this<Print> {
-  Print(std::shared_ptr<Expr> expression)
-    : expression{std::move(expression)}
+struct Print: Stmt {
+  Print(Expr* expression)
+    : Stmt{StmtType::PRINT}, expression{std::move(expression)}
   {}
 
-  std::any accept(StmtVisitor& visitor) override {
-    return visitor.visitPrintStmt(shared_from_this());
-  }
-
-  const std::shared_ptr<Expr> expression;
+  Expr* const expression;
 };
 
-struct Return: Stmt, public std::enable_shared_from_this<Return> {
-  Return(Token keyword, std::shared_ptr<Expr> value)
-    : keyword{std::move(keyword)}, value{std::move(value)}
+struct Return: Stmt {
+  Return(Token keyword, Expr* value)
+    : Stmt{StmtType::RETURN}, keyword{std::move(keyword)}, value{std::move(value)}
   {}
 
-  std::any accept(StmtVisitor& visitor) override {
-    return visitor.visitReturnStmt(shared_from_this());
-  }
-
   const Token keyword;
-  const std::shared_ptr<Expr> value;
+  Expr* const value;
 };
 
-struct Var: Stmt, public std::enable_shared_from_this<Var> {
-  Var(Token name, std::shared_ptr<Expr> initializer)
-    : name{std::move(name)}, initializer{std::move(initializer)}
+struct Var: Stmt {
+  Var(Token name, Expr* initializer)
+    : Stmt{StmtType::VAR}, name{std::move(name)}, initializer{std::move(initializer)}
   {}
 
-  std::any accept(StmtVisitor& visitor) override {
-    return visitor.visitVarStmt(shared_from_this());
-  }
-
   const Token name;
-  const std::shared_ptr<Expr> initializer;
+  Expr* const initializer;
 };
 
-struct While: Stmt, public std::enable_shared_from_this<While> {
-  While(std::shared_ptr<Expr> condition, std::shared_ptr<Stmt> body)
-    : condition{std::move(condition)}, body{std::move(body)}
+struct While: Stmt {
+  While(Expr* condition, Stmt* body)
+    : Stmt{StmtType::WHILE}, condition{std::move(condition)}, body{std::move(body)}
   {}
 
-  std::any accept(StmtVisitor& visitor) override {
-    return visitor.visitWhileStmt(shared_from_this());
-  }
-
-  const std::shared_ptr<Expr> condition;
-  const std::shared_ptr<Stmt> body;
+  Expr* const condition;
+  Stmt* const body;
 };
 
+template <class R>
+R Stmt::accept(StmtVisitor<R>& visitor) {
+  switch (type) {
+    case StmtType::BLOCK:
+      return visitor.visitBlockStmt(static_cast<Block*>(this));
+    case StmtType::CLASS:
+      return visitor.visitClassStmt(static_cast<Class*>(this));
+    case StmtType::EXPRESSION:
+      return visitor.visitExpressionStmt(static_cast<Expression*>(this));
+    case StmtType::FUNCTION:
+      return visitor.visitFunctionStmt(static_cast<Function*>(this));
+    case StmtType::IF:
+      return visitor.visitIfStmt(static_cast<If*>(this));
+    case StmtType::PRINT:
+      return visitor.visitPrintStmt(static_cast<Print*>(this));
+    case StmtType::RETURN:
+      return visitor.visitReturnStmt(static_cast<Return*>(this));
+    case StmtType::VAR:
+      return visitor.visitVarStmt(static_cast<Var*>(this));
+    case StmtType::WHILE:
+      return visitor.visitWhileStmt(static_cast<While*>(this));
+  }
+
+  // Unreachable.
+  return R();
+}
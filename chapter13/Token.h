@@ -1,20 +1,27 @@
 #pragma once
 
-#include <any>
 #include <string>
+#include <string_view>
 #include <utility>      // std::move
+#include "Number.h"
 #include "TokenType.h"
+#include "Value.h"
 
+// The lexeme is a view into the source, which is kept as long as the
+// code that was compiled from it, so a token owns no memory of its
+// own and is cheap to copy. A literal's value is scanned once: a
+// number is held inline and a string shares its buffer with every
+// other literal that has the same text.
 class Token {
 public:
   const TokenType type;
-  const std::string lexeme;
-  const std::any literal;
+  const std::string_view lexeme;
+  const Value literal;
   const int line;
 
-  Token(TokenType type, std::string lexeme, std::any literal,
+  Token(TokenType type, std::string_view lexeme, Value literal,
         int line)
-    : type{type}, lexeme{std::move(lexeme)},
+    : type{type}, lexeme{lexeme},
       literal{std::move(literal)}, line{line}
   {}
 
@@ -23,14 +30,16 @@ public:
 
     switch (type) {
       case (IDENTIFIER):
-        literal_text = lexeme;
+        literal_text = std::string{lexeme};
         break;
       case (STRING):
-        literal_text = std::any_cast<std::string>(literal);
+        literal_text = literal.asString();
         break;
-      case (NUMBER):
-        literal_text = std::to_string(std::any_cast<double>(literal));
+      case (NUMBER): {
+        char buffer[NUMBER_LENGTH];
+        literal_text = formatNumber(literal.asNumber(), buffer);
         break;
+      }
       case (TRUE):
         literal_text = "true";
         break;
@@ -41,6 +50,7 @@ public:
         literal_text = "nil";
     }
 
-    return ::toString(type) + " " + lexeme + " " + literal_text;
+    return ::toString(type) + " " + std::string{lexeme} + " " +
+           literal_text;
   }
 };
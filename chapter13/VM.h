@@ -0,0 +1,594 @@
+#pragma once
+
+#include <cstddef>      // std::size_t
+#include <cstdint>      // std::uint8_t, std::uint16_t
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>      // std::move
+#include <vector>
+#include "BytecodeCompiler.h"
+#include "Chunk.h"
+#include "Environment.h"
+#include "Error.h"
+#include "Heap.h"
+#include "Interpreter.h"
+#include "LoxClass.h"
+#include "LoxFunction.h"
+#include "LoxInstance.h"
+#include "RuntimeError.h"
+#include "Stmt.h"
+#include "Value.h"
+
+// A function whose body has been compiled to bytecode.
+class VMFunction: public LoxFunction {
+  friend class VM;
+  std::shared_ptr<const Chunk> chunk;
+
+protected:
+  Value execute(Interpreter& interpreter,
+                std::shared_ptr<Environment> environment) override;
+
+public:
+  VMFunction(Function* declaration,
+             std::shared_ptr<Environment> closure,
+             bool isInitializer,
+             std::shared_ptr<const Chunk> chunk)
+    : LoxFunction{declaration, std::move(closure), isInitializer},
+      chunk{std::move(chunk)}
+  {}
+
+  std::shared_ptr<LoxFunction> bind(
+      std::shared_ptr<LoxInstance> instance) override {
+    auto bound = std::make_shared<VMFunction>(*this);
+    bound->receiver = std::move(instance);
+    return bound;
+  }
+};
+
+// Runs bytecode on a stack of values. Calls between Lox functions
+// push a frame instead of recursing in C++, and return by popping it,
+// so unlike the Interpreter the VM needs no exceptions to return.
+//
+// The VM shares the Interpreter's runtime: globals, environments and
+// objects are the same as in the other engines. Local variables still
+// live in environments rather than on the stack, since closures keep
+// their environments alive after the call that created them returns.
+class VM {
+  friend class VMFunction;
+
+  struct CallFrame {
+    // Null for the top-level script.
+    std::shared_ptr<VMFunction> function;
+    const Chunk* chunk;
+    const std::uint8_t* ip;
+
+    // The caller's environment and stack, to be restored on return.
+    std::shared_ptr<Environment> environment;
+    std::size_t stackBase;
+
+    // The instance a method was called on, which an initializer
+    // returns.
+    std::shared_ptr<LoxInstance> receiver;
+  };
+
+  Interpreter& interpreter;
+
+  std::vector<Value> stack;
+  std::vector<CallFrame> frames;
+  std::shared_ptr<Environment> environment;
+
+  // The frame that is executing and its instruction pointer, kept in
+  // locals of the VM rather than read through frames.back().
+  const Chunk* chunk = nullptr;
+  const std::uint8_t* ip = nullptr;
+
+  // The start of the instruction being executed, for error reporting.
+  const std::uint8_t* instruction = nullptr;
+
+public:
+  VM(Interpreter& interpreter)
+    : interpreter{interpreter}
+  {}
+
+  void interpret(const std::vector<Stmt*>& statements) {
+    BytecodeCompiler compiler{interpreter.globals};
+    std::shared_ptr<const Chunk> script = compiler.compile(statements);
+
+    // Stop if the code was too large to compile.
+    if (hadError) return;
+
+    try {
+      run(script.get(), nullptr);
+    } catch (RuntimeError error) {
+      runtimeError(error);
+    }
+  }
+
+private:
+  // Runs a chunk until the frame it was started in returns, and
+  // produces its return value.
+  Value run(const Chunk* code,
+            std::shared_ptr<Environment> environment) {
+    std::size_t baseFrame = frames.size();
+    pushFrame(nullptr, code, std::move(environment));
+
+    for (;;) {
+      instruction = ip;
+      switch (static_cast<OpCode>(*ip++)) {
+        case OpCode::CONSTANT:
+          push(chunk->constants[readShort()]);
+          break;
+
+        case OpCode::NIL: push(nullptr); break;
+        case OpCode::TRUE: push(true); break;
+        case OpCode::FALSE: push(false); break;
+        case OpCode::POP: stack.pop_back(); break;
+
+        case OpCode::GET_LOCAL: {
+          int depth = readShort();
+          int slot = readShort();
+          push(this->environment->getAt(depth, slot));
+          break;
+        }
+
+        case OpCode::SET_LOCAL: {
+          int depth = readShort();
+          int slot = readShort();
+          this->environment->assignAt(depth, slot, stack.back());
+          break;
+        }
+
+        case OpCode::DEFINE_LOCAL:
+          this->environment->define(pop());
+          break;
+
+        case OpCode::GET_GLOBAL:
+          push(interpreter.globals.get(readShort(), token()));
+          break;
+
+        case OpCode::SET_GLOBAL:
+          interpreter.globals.assign(readShort(), token(),
+                                     stack.back());
+          break;
+
+        case OpCode::DEFINE_GLOBAL:
+          interpreter.globals.define(readShort(), pop());
+          break;
+
+        case OpCode::GET_PROPERTY: {
+          Value object = pop();
+          if (!object.isInstance()) {
+            throw RuntimeError(token(),
+                "Only instances have properties.");
+          }
+
+          PropertyCache& cache = *chunk->caches[readShort()];
+          push(object.asInstance()->get(token(), cache));
+          break;
+        }
+
+        case OpCode::CHECK_INSTANCE:
+          if (!stack.back().isInstance()) {
+            throw RuntimeError(token(), "Only instances have fields.");
+          }
+          break;
+
+        case OpCode::SET_PROPERTY: {
+          PropertyCache& cache = *chunk->caches[readShort()];
+          Value value = pop();
+          Value object = pop();
+          object.asInstance()->set(token(), value, cache);
+          push(std::move(value));
+          break;
+        }
+
+        case OpCode::GET_SUPER: {
+          std::shared_ptr<LoxInstance> object;
+          std::shared_ptr<LoxFunction> method =
+              superMethod(readShort(), object);
+          push(method->bind(std::move(object)));
+          break;
+        }
+
+        // A method about to be called is pushed along with its
+        // instance, rather than bound to it. A field is pushed along
+        // with nil, and called as it is.
+        case OpCode::GET_METHOD: {
+          Value object = pop();
+          if (!object.isInstance()) {
+            throw RuntimeError(token(),
+                "Only instances have properties.");
+          }
+
+          PropertyCache& cache = *chunk->caches[readShort()];
+          const std::shared_ptr<LoxInstance>& instance =
+              object.asInstance();
+          std::shared_ptr<LoxFunction> method =
+              instance->getMethod(token(), cache);
+
+          if (method != nullptr) {
+            push(std::move(method));
+            push(instance);
+          } else {
+            push(instance->get(token(), cache));
+            push(nullptr);
+          }
+          break;
+        }
+
+        case OpCode::GET_SUPER_METHOD: {
+          std::shared_ptr<LoxInstance> object;
+          push(superMethod(readShort(), object));
+          push(std::move(object));
+          break;
+        }
+
+        case OpCode::EQUAL: {
+          Value b = pop();
+          stack.back() = interpreter.isEqual(stack.back(), b);
+          break;
+        }
+
+        case OpCode::NOT_EQUAL: {
+          Value b = pop();
+          stack.back() = !interpreter.isEqual(stack.back(), b);
+          break;
+        }
+
+        case OpCode::GREATER:
+          binary(std::greater<double>{});
+          break;
+        case OpCode::GREATER_EQUAL:
+          binary(std::greater_equal<double>{});
+          break;
+        case OpCode::LESS: binary(std::less<double>{}); break;
+        case OpCode::LESS_EQUAL:
+          binary(std::less_equal<double>{});
+          break;
+
+        case OpCode::ADD: {
+          Value b = pop();
+          Value& a = stack.back();
+
+          if (a.isNumber() && b.isNumber()) {
+            a = a.asNumber() + b.asNumber();
+          } else if (a.isString() && b.isString()) {
+            a = a.asString() + b.asString();
+          } else {
+            throw RuntimeError{token(),
+                "Operands must be two numbers or two strings."};
+          }
+          break;
+        }
+
+        case OpCode::SUBTRACT: binary(std::minus<double>{}); break;
+        case OpCode::MULTIPLY: binary(std::multiplies<double>{}); break;
+        case OpCode::DIVIDE: binary(std::divides<double>{}); break;
+
+        case OpCode::NOT:
+          stack.back() = !interpreter.isTruthy(stack.back());
+          break;
+
+        case OpCode::NEGATE:
+          interpreter.checkNumberOperand(token(), stack.back());
+          stack.back() = -stack.back().asNumber();
+          break;
+
+        case OpCode::PRINT:
+          interpreter.print(pop());
+          break;
+
+        case OpCode::JUMP: {
+          int offset = readShort();
+          ip += offset;
+          break;
+        }
+
+        case OpCode::JUMP_IF_FALSE: {
+          int offset = readShort();
+          if (!interpreter.isTruthy(stack.back())) ip += offset;
+          break;
+        }
+
+        case OpCode::LOOP: {
+          int offset = readShort();
+          ip -= offset;
+          heap.collectIfNeeded();
+          break;
+        }
+
+        case OpCode::CALL: call(*ip++, false); break;
+        case OpCode::INVOKE: invoke(*ip++, false); break;
+        case OpCode::TAIL_CALL: call(*ip++, true); break;
+        case OpCode::TAIL_INVOKE: invoke(*ip++, true); break;
+
+        case OpCode::FUNCTION: {
+          const FunctionPrototype& function =
+              chunk->functions[readShort()];
+          push(std::shared_ptr<LoxFunction>{
+              std::make_shared<VMFunction>(function.declaration,
+                  this->environment, false, function.chunk)});
+          break;
+        }
+
+        case OpCode::CLASS: {
+          const ClassPrototype& klass = chunk->classes[readShort()];
+
+          std::shared_ptr<LoxClass> superclass = nullptr;
+          if (klass.declaration->superclass != nullptr) {
+            superclass = this->environment->getAt(0, 0).asClass();
+          }
+
+          std::map<std::string, std::shared_ptr<LoxFunction>> methods;
+          for (const FunctionPrototype& method : klass.methods) {
+            std::string name{method.declaration->name.lexeme};
+            methods[name] = std::make_shared<VMFunction>(
+                method.declaration, this->environment, name == "init",
+                method.chunk);
+          }
+
+          push(std::make_shared<LoxClass>(
+              std::string{klass.declaration->name.lexeme}, superclass,
+              methods));
+          break;
+        }
+
+        case OpCode::INHERIT: {
+          Value superclass = pop();
+          if (!superclass.isClass()) {
+            throw RuntimeError(token(), "Superclass must be a class.");
+          }
+
+          this->environment =
+              std::make_shared<Environment>(this->environment);
+          this->environment->define(std::move(superclass));
+          break;
+        }
+
+        case OpCode::BEGIN_SCOPE:
+          this->environment =
+              std::make_shared<Environment>(this->environment);
+          break;
+
+        case OpCode::END_SCOPE:
+          this->environment = this->environment->enclosing;
+          break;
+
+        case OpCode::RETURN: {
+          Value result = pop();
+          CallFrame& frame = frames.back();
+
+          if (frame.function != nullptr &&
+              frame.function->isInitializer) {
+            result = frame.receiver;
+          }
+
+          this->environment = std::move(frame.environment);
+          stack.resize(frame.stackBase);
+          frames.pop_back();
+
+          if (frames.size() == baseFrame) {
+            if (!frames.empty()) resumeFrame();
+            return result;
+          }
+
+          resumeFrame();
+          push(std::move(result));
+          break;
+        }
+      }
+    }
+  }
+
+  // A tail call to a Lox function takes over the frame of the function
+  // making it. Classes and native functions are called as usual, and
+  // the RETURN that follows a tail call returns their result.
+  void call(int argCount, bool tail) {
+    Value& callee = stack[stack.size() - argCount - 1];
+
+    switch (callee.type()) {
+      case ValueType::FUNCTION: {
+        // Every function created while the VM runs is a VMFunction.
+        auto function = std::static_pointer_cast<VMFunction>(
+            callee.asFunction());
+        std::shared_ptr<LoxInstance> receiver = function->receiver;
+        callFunction(std::move(function), argCount,
+                     std::move(receiver), tail);
+        return;
+      }
+
+      case ValueType::CLASS: {
+        std::shared_ptr<LoxClass> klass = callee.asClass();
+        checkArity(klass->arity(), argCount);
+
+        auto instance = std::make_shared<LoxInstance>(klass);
+        const std::shared_ptr<LoxFunction>& initializer =
+            klass->initializer();
+
+        // The initializer returns the instance itself.
+        if (initializer != nullptr) {
+          callFunction(std::static_pointer_cast<VMFunction>(
+              initializer), argCount, std::move(instance), false);
+          return;
+        }
+
+        stack.resize(stack.size() - argCount - 1);
+        push(std::move(instance));
+        return;
+      }
+
+      case ValueType::NATIVE: {
+        std::shared_ptr<LoxCallable> native = callee.asNative();
+        checkArity(native->arity(), argCount);
+
+        // The arguments are passed right where they are on the stack.
+        Arguments arguments{stack.data() + stack.size() - argCount,
+                            static_cast<std::size_t>(argCount)};
+        Value result = native->call(interpreter, arguments);
+        stack.resize(stack.size() - argCount - 1);
+        push(std::move(result));
+        return;
+      }
+
+      default:
+        throw RuntimeError{token(),
+            "Can only call functions and classes."};
+    }
+  }
+
+  void invoke(int argCount, bool tail) {
+    auto receiver = stack.end() - argCount - 1;
+    if (receiver->isNil()) {
+      stack.erase(receiver);
+      call(argCount, tail);
+      return;
+    }
+
+    std::shared_ptr<LoxInstance> instance = receiver->asInstance();
+    stack.erase(receiver);
+
+    // Every method is a VMFunction, as in call().
+    callFunction(std::static_pointer_cast<VMFunction>(
+        stack[stack.size() - argCount - 1].asFunction()),
+        argCount, std::move(instance), tail);
+  }
+
+  // A method's receiver goes in the first slot of its environment,
+  // ahead of the arguments.
+  void callFunction(std::shared_ptr<VMFunction> function, int argCount,
+                    std::shared_ptr<LoxInstance> receiver, bool tail) {
+    checkArity(function->arity(), argCount);
+    heap.collectIfNeeded();
+
+    // Frames live on the heap, but the VM still allows no deeper
+    // calls than the other engines do. The script has a frame too.
+    if (!tail && frames.size() > interpreter.maxCallDepth) {
+      throw RuntimeError{token(), "Stack overflow."};
+    }
+
+    auto environment = std::make_shared<Environment>(
+        function->closure, function->declaration->locals);
+    if (receiver != nullptr) environment->define(receiver);
+    for (auto arg = stack.end() - argCount; arg != stack.end(); ++arg) {
+      environment->define(std::move(*arg));
+    }
+    stack.resize(stack.size() - argCount - 1);
+
+    const Chunk* code = function->chunk.get();
+    if (tail) {
+      replaceFrame(std::move(function), code, std::move(environment));
+    } else {
+      pushFrame(std::move(function), code, std::move(environment));
+    }
+    frames.back().receiver = std::move(receiver);
+  }
+
+  // Finds the method "super" refers to, along with the instance it
+  // should be called on.
+  std::shared_ptr<LoxFunction> superMethod(
+      int distance, std::shared_ptr<LoxInstance>& object) {
+    // "super" is alone in its scope, which is the closure of the
+    // method. The method's own environment, just inside it, holds
+    // "this" in its first slot.
+    std::shared_ptr<LoxClass> superclass =
+        this->environment->getAt(distance, 0).asClass();
+
+    object = this->environment->getAt(distance - 1, 0).asInstance();
+
+    const Token& name = token();
+    std::shared_ptr<LoxFunction> method =
+        superclass->findMethod(name.lexeme);
+
+    if (method == nullptr) {
+      throw RuntimeError(name,
+          "Undefined property '" + std::string{name.lexeme} + "'.");
+    }
+
+    return method;
+  }
+
+  void checkArity(int arity, int argCount) {
+    if (argCount != arity) {
+      throw RuntimeError{token(), "Expected " +
+          std::to_string(arity) + " arguments but got " +
+          std::to_string(argCount) + "."};
+    }
+  }
+
+  void pushFrame(std::shared_ptr<VMFunction> function,
+                 const Chunk* code,
+                 std::shared_ptr<Environment> environment) {
+    if (!frames.empty()) frames.back().ip = ip;
+
+    frames.push_back(CallFrame{std::move(function), code, nullptr,
+                               std::move(this->environment),
+                               stack.size(), nullptr});
+    this->environment = std::move(environment);
+    chunk = code;
+    ip = code->code.data();
+  }
+
+  // The function making a tail call has nothing left to do, so the
+  // callee runs in its frame and returns straight to its caller. The
+  // caller's environment and stack base stay as they were.
+  void replaceFrame(std::shared_ptr<VMFunction> function,
+                    const Chunk* code,
+                    std::shared_ptr<Environment> environment) {
+    CallFrame& frame = frames.back();
+    frame.function = std::move(function);
+    frame.chunk = code;
+    stack.resize(frame.stackBase);
+
+    this->environment = std::move(environment);
+    chunk = code;
+    ip = code->code.data();
+  }
+
+  void resumeFrame() {
+    chunk = frames.back().chunk;
+    ip = frames.back().ip;
+  }
+
+  // The result replaces the left operand in place.
+  template <class Op>
+  void binary(Op op) {
+    Value& a = stack[stack.size() - 2];
+    const Value& b = stack.back();
+    interpreter.checkNumberOperands(token(), a, b);
+    a = op(a.asNumber(), b.asNumber());
+    stack.pop_back();
+  }
+
+  template <class T>
+  void push(T&& value) {
+    stack.emplace_back(std::forward<T>(value));
+  }
+
+  Value pop() {
+    Value value = std::move(stack.back());
+    stack.pop_back();
+    return value;
+  }
+
+  int readShort() {
+    ip += 2;
+    return ip[-2] | (ip[-1] << 8);
+  }
+
+  const Token& token() {
+    return *chunk->tokens[instruction - chunk->code.data()];
+  }
+};
+
+// Only reached when something outside of the VM calls the function.
+// The body runs on a VM of its own, and its result is handed back
+// the way LoxFunction::call() expects.
+inline Value VMFunction::execute(
+    Interpreter& interpreter,
+    std::shared_ptr<Environment> environment) {
+  VM vm{interpreter};
+  return vm.run(chunk.get(), std::move(environment));
+}
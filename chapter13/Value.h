@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstddef>      // std::nullptr_t
+#include <cstdint>      // std::uint8_t
+#include <memory>
+#include <string>
+#include <utility>      // std::move
+#include <variant>
+
+class LoxCallable;
+class LoxClass;
+class LoxFunction;
+class LoxInstance;
+
+// The order of the enumerators matches the order of the alternatives
+// in Value, so a value's type is simply the index of the alternative
+// it holds. libstdc++ and libc++ both store that index in a single
+// byte for a variant this small.
+enum class ValueType: std::uint8_t {
+  NIL, BOOL, NUMBER, STRING, FUNCTION, CLASS, INSTANCE, NATIVE
+};
+
+// Our jlox values used to be held in std::any, which asks the RTTI
+// system for the dynamic type on every check and may allocate on
+// every copy. A Value instead keeps nil, Booleans and numbers inline
+// and only holds a pointer for strings and objects. Strings are
+// immutable in Lox, so every copy of a string value can share the
+// same buffer.
+class Value {
+  std::variant<std::nullptr_t, bool, double,
+               std::shared_ptr<const std::string>,
+               std::shared_ptr<LoxFunction>,
+               std::shared_ptr<LoxClass>,
+               std::shared_ptr<LoxInstance>,
+               std::shared_ptr<LoxCallable>> as;
+
+public:
+  Value()
+    : as{nullptr}
+  {}
+
+  Value(std::nullptr_t)
+    : as{nullptr}
+  {}
+
+  Value(bool boolean)
+    : as{boolean}
+  {}
+
+  Value(double number)
+    : as{number}
+  {}
+
+  Value(std::string string)
+    : as{std::make_shared<const std::string>(std::move(string))}
+  {}
+
+  // Without this overload a string literal would be converted to
+  // bool instead of std::string.
+  Value(const char* string)
+    : Value{std::string{string}}
+  {}
+
+  Value(std::shared_ptr<LoxFunction> function)
+    : as{std::move(function)}
+  {}
+
+  Value(std::shared_ptr<LoxClass> klass)
+    : as{std::move(klass)}
+  {}
+
+  Value(std::shared_ptr<LoxInstance> instance)
+    : as{std::move(instance)}
+  {}
+
+  // Native functions.
+  Value(std::shared_ptr<LoxCallable> native)
+    : as{std::move(native)}
+  {}
+
+  ValueType type() const {
+    return static_cast<ValueType>(as.index());
+  }
+
+  bool isNil() const { return type() == ValueType::NIL; }
+  bool isBool() const { return type() == ValueType::BOOL; }
+  bool isNumber() const { return type() == ValueType::NUMBER; }
+  bool isString() const { return type() == ValueType::STRING; }
+  bool isFunction() const { return type() == ValueType::FUNCTION; }
+  bool isClass() const { return type() == ValueType::CLASS; }
+  bool isInstance() const { return type() == ValueType::INSTANCE; }
+  bool isNative() const { return type() == ValueType::NATIVE; }
+
+  // The accessors assume the caller already checked the type.
+  bool asBool() const { return std::get<bool>(as); }
+  double asNumber() const { return std::get<double>(as); }
+
+  const std::string& asString() const {
+    return *std::get<std::shared_ptr<const std::string>>(as);
+  }
+
+  const std::shared_ptr<LoxFunction>& asFunction() const {
+    return std::get<std::shared_ptr<LoxFunction>>(as);
+  }
+
+  const std::shared_ptr<LoxClass>& asClass() const {
+    return std::get<std::shared_ptr<LoxClass>>(as);
+  }
+
+  const std::shared_ptr<LoxInstance>& asInstance() const {
+    return std::get<std::shared_ptr<LoxInstance>>(as);
+  }
+
+  const std::shared_ptr<LoxCallable>& asNative() const {
+    return std::get<std::shared_ptr<LoxCallable>>(as);
+  }
+
+  // Strings compare by value, objects by identity.
+  friend bool operator==(const Value& a, const Value& b) {
+    if (a.type() != b.type()) return false;
+
+    switch (a.type()) {
+      case ValueType::NIL: return true;
+      case ValueType::BOOL: return a.asBool() == b.asBool();
+      case ValueType::NUMBER: return a.asNumber() == b.asNumber();
+      case ValueType::STRING: return a.asString() == b.asString();
+      case ValueType::FUNCTION: return a.asFunction() == b.asFunction();
+      case ValueType::CLASS: return a.asClass() == b.asClass();
+      case ValueType::INSTANCE: return a.asInstance() == b.asInstance();
+      case ValueType::NATIVE: return a.asNative() == b.asNative();
+    }
+
+    // Unreachable.
+    return false;
+  }
+};